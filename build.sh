@@ -1,5 +1,9 @@
 clear
 rm ./bin/dtm
 rm ./bin/dtm-repl
-gccp dtm.cpp -o ./bin/dtm -Lvendor/curl/include/curl -lcurl
-gccp repl.cpp -o ./bin/dtm-repl -Lvendor/curl/include/curl -lcurl -L/opt/local/lib -lreadline 
+rm ./bin/libdtm.so
+rm ./bin/test-import-keys
+gccp -std=c++11 -pthread -shared -fPIC -fvisibility=hidden lib/client.cpp -o ./bin/libdtm.so -Lvendor/curl/include/curl -lcurl
+gccp -std=c++11 -pthread dtm.cpp -o ./bin/dtm -Lvendor/curl/include/curl -lcurl -lz -L./bin -ldtm -Wl,-rpath,'$ORIGIN'
+gccp -std=c++11 -pthread repl.cpp -o ./bin/dtm-repl -Lvendor/curl/include/curl -lcurl -L/opt/local/lib -lreadline -L./bin -ldtm -Wl,-rpath,'$ORIGIN'
+gccp -std=c++11 -pthread test/import_keys.cpp -o ./bin/test-import-keys -Lvendor/curl/include/curl -lcurl -L./bin -ldtm -Wl,-rpath,'$ORIGIN' && ./bin/test-import-keys
@@ -1,6 +1,19 @@
 #//define DEBUG
 #include "vendor/edn-cpp/edn.hpp"
 #include "lib/datomicRest.hpp"
+#include "lib/profile.hpp"
+#include "lib/scan.hpp"
+#include "lib/stream.hpp"
+#include "lib/batch.hpp"
+#include "lib/validate.hpp"
+#include "lib/import.hpp"
+#include "lib/retract.hpp"
+#include "lib/diff.hpp"
+#include "lib/sort.hpp"
+#include "lib/entities.hpp"
+#include "lib/txstats.hpp"
+#include "lib/summary.hpp"
+#include "lib/export.hpp"
 #include <string>
 #include <iostream>
 #include <sstream>
@@ -8,6 +21,7 @@
 #include <stdlib.h>
 #include <vector>
 #include <map>
+#include <fstream>
 
 using std::string;
 using std::cout;
@@ -16,6 +30,10 @@ using std::endl;
 namespace DR = datomicRest;
 
 std::map<string, string> args;
+bool streaming = false;
+bool dryRun = false;
+bool descending = false;
+bool summary = false;
 
 int quit(string msg = "") {
   DR::cleanup();
@@ -31,17 +49,39 @@ int help() {
     "  [query querystring]\n"
     "    expects querystring to be well formed edn\n"
     "    e.g. [:find ?n :where [_ :db/ident ?n]]\n"
+    "  [profile querystring]\n"
+    "    runs each prefix of the :where clauses as a count and reports\n"
+    "    time and intermediate rows per clause, flagging explosions\n"
+    "  [diff querystring]\n"
+    "    rows added and removed between --from t and --to t (default now),\n"
+    "    both sides are streamed concurrently and compared by hash\n"
+    "  [datoms index]\n"
+    "    stream the datoms of eavt, aevt, avet or vaet, narrowed by --e --a --v\n"
+    "    or a --start and --end range. honours --as-of --since --history\n"
+    "    --limit --offset and --out\n"
     "  [entity id]\n"
     "    fetch all attributes stored against an entity\n"
+    "  [import file]\n"
+    "    transact rows of a csv (or .tsv) file as entities of --ns. the header\n"
+    "    names attributes, a db/id column keys entities and @key refers to one.\n"
+    "    card many values are separated by |\n"
+    "    --ns namespace --batch rows per tx (1000) --in-flight txs at once (4)\n"
+    "  [retract id | - | --where querystring]\n"
+    "    retract an entity, every id read from stdin (-) or the first column\n"
+    "    of each query result row, streamed as batched retractEntity txs\n"
+    "    --batch ids per tx (1000) --in-flight txs at once (2) --dry-run\n"
     "  [entities namespace]\n"
-    "    fetch all entities for a given namespace\n"
+    "    stream every entity with an attribute of namespace, one row per entity.\n"
+    "    each attribute is scanned concurrently and merged on entity id,\n"
+    "    missing attributes are nil and card many values sets\n"
     "  [events]\n"
     "    listens to and displays events for db.\n"
+    "  [tx-stats]\n"
+    "    follows the events stream and shows tx/sec, datoms/sec, tx size\n"
+    "    percentiles and the busiest attributes and namespaces, redrawn every\n"
+    "    --interval seconds (5), or as one line per interval with -f JSON\n"
     "  [with-event handler]\n"
     "    listens for event and then executes handler\n"
-    "  [datoms args]\n"
-    "    direct access to the datoms. args is well formed edn map.\n"
-    "    {:start :end :offset :limit :as-of :since :history}\n"
     "  [idents namespace]\n"
     "    fetch idents in enum for namespace\n"
     "  [create-ident ident]\n"
@@ -69,6 +109,8 @@ int help() {
     "    list all functions for namespace\n" 
     "  [create-fn]\n"  
     "    prompt for creating a new fn\n"
+    "  [scan-bench file]\n"
+    "    compare result scanning throughput (scalar, simd, edn::read) on a saved result\n"
     "  [help]\n"
     "    this information\n"
     "args: \n"
@@ -85,6 +127,29 @@ int help() {
     "  [--offset]\n"
     "    integer offset for dealing with large query results\n"
     "    (.e.g which page of results where page is based on limit)\n"
+    "  [--args]\n"
+    "    edn vector of additional query inputs bound after $ e.g. [\"foo\" 42]\n"
+    "  [--as-of t] [--since t] [--history]\n"
+    "    read query, entity and entities against a past or filtered db\n"
+    "  [--validate]\n"
+    "    check transact and import data against the schema before sending:\n"
+    "    attributes, idents, value types, cardinality, unique values, tempids\n"
+    "  [--stream]\n"
+    "    receive, parse and print query results concurrently row by row\n"
+    "    (TBL is printed as TSV as columns can not be sized up front)\n"
+    "  [--sample n]\n"
+    "    a uniform random sample of n rows of a query, drawn as it streams\n"
+    "  [--summary]\n"
+    "    per column rows, nils, approximate distinct count, min, max,\n"
+    "    p50/p90/p99 of numbers and most common values of a query in one pass\n"
+    "  [--out file]\n"
+    "    write query or datoms rows to file as edn lines, compressed in blocks\n"
+    "    on every core as independent gzip members (zcat reads it whole) and\n"
+    "    indexed by offset and first row in file.idx for random access\n"
+    "  [--sort-by ?var] [--top k] [--desc] [--sort-mem mb]\n"
+    "    streams a query sorted by a :find element, numbers, instants then text.\n"
+    "    --top keeps only the first k rows, larger results than --sort-mem (256)\n"
+    "    are sorted in runs spilled to temporary files and merged\n"
     "  [--limit]\n"
     "    integer limit for dealing with large query results (number of records to see at a time)"); 
 }
@@ -110,9 +175,34 @@ int main(int argc, char *argv[]) {
     } else if (arg == "--verbose") { 
       DR::verbose = true;
       continue;
+    } else if (arg == "--stream") {
+      streaming = true;
+      continue;
+    } else if (arg == "--dry-run") {
+      dryRun = true;
+      continue;
+    } else if (arg == "--validate") {
+      DR::validate = true;
+      continue;
+    } else if (arg == "--summary") {
+      summary = true;
+      continue;
+    } else if (arg == "--desc") {
+      descending = true;
+      continue;
+    } else if (arg == "--history") {
+      DR::history = true;
+      continue;
+    } else if (arg == "retract") {
+      //takes - or an id, or nothing when used with --where
+      command = arg;
+      if (i < argc - 1 && string(argv[i + 1]).substr(0, 2) != "--")
+        args[arg] = string(argv[++i]);
+      continue;
     } else if (arg == "aliases"    || arg == "databases" || 
                arg == "namespaces" || arg == "fns"       ||
-               arg == "create-fn"  || arg == "events") {
+               arg == "create-fn"  || arg == "events"    ||
+               arg == "tx-stats") {
       command = arg;
       continue;
     } else if (arg == "query"      || arg == "entity"          || 
@@ -120,7 +210,10 @@ int main(int argc, char *argv[]) {
                arg == "attributes" || arg == "create-entity  " || 
                arg == "fns-in"     || arg == "entities"        || 
                arg == "idents"     || arg == "create-ident"    || 
-               arg == "offset"     || arg == "limit") {
+               arg == "offset"     || arg == "limit"           ||
+               arg == "profile"    || arg == "scan-bench"      ||
+               arg == "import"     || arg == "diff"            ||
+               arg == "datoms") {
       command = arg;
     }
 
@@ -132,6 +225,16 @@ int main(int argc, char *argv[]) {
 
   if (!command.length()) return help();
 
+  if (command == "scan-bench") {
+    std::ifstream file(args.at("scan-bench").c_str(), std::ios::in | std::ios::binary);
+    if (!file) return quit("Could not open " + args.at("scan-bench"));
+    std::stringstream contents;
+    contents << file.rdbuf();
+    result = DR::benchScan(contents.str());
+    printResult(result);
+    return quit();
+  }
+
   if (args.count("--offset"))
     if(edn::validInt(args.at("--offset"), false))
       DR::queryOffset = atoi(args.at("--offset").c_str());
@@ -174,6 +277,21 @@ int main(int argc, char *argv[]) {
   else if (DR::host.empty())
     return quit("Error: no host provided via -h --host or set in env as DTM_HOST");
 
+  if (args.count("--as-of"))
+    DR::asOf = args.at("--as-of");
+
+  if (args.count("--since"))
+    DR::since = args.at("--since");
+
+  if (command == "entity" && DR::history)
+    return quit("--history is only supported for query and entities");
+
+  if (command == "diff") {
+    if (!args.count("--from")) return quit("diff expects --from t");
+    result = DR::diffQuery(args.at("diff"), args.count("--args") ? args.at("--args") : "",
+                           args.at("--from"), args.count("--to") ? args.at("--to") : "");
+  }
+
   if (command == "aliases")
     result = DR::getStorages();
 
@@ -189,6 +307,17 @@ int main(int argc, char *argv[]) {
     return quit("done");
   }
 
+  if (command == "tx-stats") {
+    int interval = 5;
+    if (args.count("--interval")) {
+      if (!edn::validInt(args.at("--interval"), false))
+        return quit("Invalid interval provided. seconds expected e.g. 5");
+      interval = atoi(args.at("--interval").c_str());
+    }
+    printResult(DR::txStats(interval));
+    return quit();
+  }
+
   if (command == "namespaces")
     result = DR::getNamespaces();
 
@@ -206,7 +335,10 @@ int main(int argc, char *argv[]) {
   }
 
   if (command == "entities") { 
-    result = DR::getEntities(args.at("entities"));
+    DR::RowWriter writer;
+    result = DR::streamEntities(args.at("entities"), writer);
+    if (result.type != edn::EdnNil) printResult(result);
+    return quit();
   }
 
   if (command == "create-entity") {
@@ -241,8 +373,154 @@ int main(int argc, char *argv[]) {
     result = DR::transact(tx + "}]");
   }
 
+  if (command == "import") {
+    if (!args.count("--ns")) return quit("import expects --ns namespace");
+    int batchSize = 1000;
+    int inFlight = 4;
+    if (args.count("--batch")) {
+      if (!edn::validInt(args.at("--batch"), false))
+        return quit("Invalid batch provided. unsigned int expected e.g. 1000");
+      batchSize = atoi(args.at("--batch").c_str());
+    }
+    if (args.count("--in-flight")) {
+      if (!edn::validInt(args.at("--in-flight"), false))
+        return quit("Invalid in-flight provided. unsigned int expected e.g. 4");
+      inFlight = atoi(args.at("--in-flight").c_str());
+    }
+    try {
+      result = DR::importFile(args.at("import"), args.at("--ns"), batchSize, inFlight);
+    } catch (const char* e) {
+      return quit("Error importing: " + string(e));
+    }
+  }
+
+  if (command == "retract") {
+    int batchSize = 1000;
+    int inFlight = 2;
+    if (args.count("--batch")) {
+      if (!edn::validInt(args.at("--batch"), false))
+        return quit("Invalid batch provided. unsigned int expected e.g. 1000");
+      batchSize = atoi(args.at("--batch").c_str());
+    }
+    if (args.count("--in-flight")) {
+      if (!edn::validInt(args.at("--in-flight"), false))
+        return quit("Invalid in-flight provided. unsigned int expected e.g. 2");
+      inFlight = atoi(args.at("--in-flight").c_str());
+    }
+
+    DR::RetractStream retractions(batchSize, dryRun, inFlight);
+    edn::EdnNode queryError = edn::read("nil");
+    if (args.count("--where")) {
+      queryError = DR::streamQuery(args.at("--where"), args.count("--args") ? args.at("--args") : "", retractions);
+    } else if (args.count("retract") && args.at("retract") == "-") {
+      retractions.read(std::cin);
+    } else if (args.count("retract")) {
+      std::istringstream ids(args.at("retract"));
+      retractions.read(ids);
+    } else {
+      return quit("retract expects an id, - or --where querystring");
+    }
+    //batches already sent have retracted even if the query then failed, so
+    //drain and report them before the error
+    result = retractions.finish();
+    if (queryError.type != edn::EdnNil) {
+      printResult(result);
+      printResult(queryError);
+      return quit();
+    }
+  }
+
+  if (command == "datoms" || (command == "query" && args.count("--out"))) {
+    std::unique_ptr<DR::RowSink> sink;
+    DR::BlockExport *exporter = NULL;
+    if (args.count("--out")) sink.reset(exporter = new DR::BlockExport(args.at("--out")));
+    else sink.reset(new DR::RowWriter());
+
+    if (command == "datoms") {
+      std::map<string, string> params;
+      const char *components[] = {"e", "a", "v", "start", "end"};
+      for (unsigned c = 0; c < 5; ++c)
+        if (args.count("--" + string(components[c])))
+          params[components[c]] = args.at("--" + string(components[c]));
+      result = DR::streamDatoms(args.at("datoms"), params, *sink);
+    } else {
+      result = DR::streamQuery(args.at("query"), args.count("--args") ? args.at("--args") : "", *sink);
+    }
+
+    if (exporter) result = exporter->finish(result);
+    if (result.type != edn::EdnNil) printResult(result);
+    return quit();
+  }
+
+  if (command == "query" && (summary || args.count("--sample"))) {
+    if (summary && args.count("--sample")) return quit("use one of --summary and --sample");
+    string extraArgs = args.count("--args") ? args.at("--args") : "";
+    edn::EdnNode header;
+    if (summary) {
+      DR::RowSummary rowSummary;
+      result = DR::streamQuery(args.at("query"), extraArgs, rowSummary);
+      if (result.type == edn::EdnNil) result = rowSummary.result(DR::queryHeader, header);
+    } else {
+      if (!edn::validInt(args.at("--sample"), false))
+        return quit("Invalid sample provided. unsigned int expected e.g. 100");
+      DR::RowSampler sampler(atoi(args.at("--sample").c_str()));
+      result = DR::streamQuery(args.at("query"), extraArgs, sampler);
+      header = DR::queryHeader;
+      if (result.type == edn::EdnNil) {
+        result = edn::read("[]");
+        result.values.assign(sampler.rows.begin(), sampler.rows.end());
+      }
+    }
+
+    if (DR::format == DR::TBL && result.type == edn::EdnVector && result.values.size() &&
+        result.values.front().type == edn::EdnVector && header.values.size())
+      DR::printTable(result, header);
+    else
+      printResult(result);
+    return quit();
+  }
+
+  if (command == "query" && (args.count("--sort-by") || args.count("--top"))) {
+    if (!args.count("--sort-by")) return quit("--top expects --sort-by ?var");
+    size_t top = 0;
+    if (args.count("--top")) {
+      if (!edn::validInt(args.at("--top"), false))
+        return quit("Invalid top provided. unsigned int expected e.g. 10");
+      top = atoi(args.at("--top").c_str());
+    }
+    if (args.count("--sort-mem")) {
+      if (!edn::validInt(args.at("--sort-mem"), false))
+        return quit("Invalid sort-mem provided. megabytes expected e.g. 256");
+      DR::sortMemory = size_t(atoi(args.at("--sort-mem").c_str())) * 1024 * 1024;
+    }
+
+    size_t column;
+    try {
+      column = DR::findColumn(args.at("query"), args.at("--sort-by"));
+    } catch (const char* e) {
+      return quit("Error sorting: " + string(e));
+    }
+    DR::RowWriter writer;
+    DR::RowSorter sorter(writer, column, descending, top);
+    result = DR::streamQuery(args.at("query"), args.count("--args") ? args.at("--args") : "", sorter);
+    if (result.type == edn::EdnNil && sorter.error.length())
+      result = edn::read("\"Problem: " + DR::escapeString(sorter.error) + "\"");
+    if (result.type != edn::EdnNil) printResult(result);
+    return quit();
+  }
+
+  if (command == "query" && streaming) {
+    DR::RowWriter writer;
+    result = DR::streamQuery(args.at("query"), args.count("--args") ? args.at("--args") : "", writer);
+    if (result.type != edn::EdnNil) printResult(result);
+    return quit();
+  }
+
   if (command == "query")
-    result = DR::query(args.at("query"));
+    result = DR::query(args.at("query"), args.count("--args") ? args.at("--args") : "");
+
+  if (command == "profile")
+    result = DR::profileQuery(args.at("profile"), args.count("--args") ? args.at("--args") : "");
 
   if (command == "databases")  
     result = DR::getDatabases(DR::alias);
@@ -0,0 +1,138 @@
+#include <deque>
+#include <set>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+namespace datomicRest {
+
+  struct TxBatch {
+    long number;
+    string txData;
+    size_t firstRow;
+    size_t rows;
+    //tempidKeys[n - 1] names the entity written as #db/id [:db.part/user -n]
+    vector<string> tempidKeys;
+    long responseCode;
+    string body;
+
+    TxBatch() : number(0), firstRow(0), rows(0), responseCode(0) {}
+  };
+
+  //notified on the worker thread that ran the batch, must do its own locking
+  class TxHandler {
+   public:
+    virtual ~TxHandler() {}
+    virtual void completed(TxBatch &batch) = 0;
+  };
+
+  //posts transaction batches from a fixed set of workers, each with its own
+  //curl handle. submit blocks while inFlight batches are outstanding so the
+  //producer never runs more than that far ahead of the transactor
+  class TxPool {
+    int inFlight;
+    TxHandler *handler;
+    std::deque<TxBatch> queue;
+    std::set<long> running;
+    long nextNumber;
+    bool stopping;
+    std::mutex lock;
+    std::condition_variable changed;
+    vector<std::thread> workers;
+
+    void run() {
+      CURL *handle = curl_easy_init();
+      std::unique_lock<std::mutex> guard(lock);
+      while (true) {
+        while (!stopping && !queue.size()) changed.wait(guard);
+        if (!queue.size()) break;
+
+        TxBatch batch = std::move(queue.front());
+        queue.pop_front();
+        guard.unlock();
+
+        if (verbose) cout << "TRANSACT BATCH " << batch.number << endl;
+        char *txdata = curl_easy_escape(handle, batch.txData.c_str(), 0);
+        string postData = "tx-data=" + string(txdata);
+        curl_free(txdata);
+        try {
+          batch.responseCode = perform(POST, "data/" + alias + "/" + db + "/", postData,
+                                       "Accept: application/edn", &appendCallback,
+                                       &batch.body, handle);
+        } catch (const char* e) {
+          batch.body = e;
+        }
+        if (handler) handler->completed(batch);
+
+        guard.lock();
+        running.erase(batch.number);
+        changed.notify_all();
+      }
+      curl_easy_cleanup(handle);
+    }
+
+   public:
+    TxPool(int workersInFlight, TxHandler *txHandler)
+      : inFlight(workersInFlight < 1 ? 1 : workersInFlight), handler(txHandler),
+        nextNumber(1), stopping(false) {
+      for (int i = 0; i < inFlight; ++i)
+        workers.push_back(std::thread(&TxPool::run, this));
+    }
+
+    ~TxPool() { drain(); }
+
+    //numbers the batch and queues it, returns the batch number
+    long submit(TxBatch &batch) {
+      std::unique_lock<std::mutex> guard(lock);
+      while (int(running.size()) >= inFlight) changed.wait(guard);
+      long number = nextNumber++;
+      batch.number = number;
+      running.insert(number);
+      queue.push_back(std::move(batch));
+      changed.notify_all();
+      return number;
+    }
+
+    void waitFor(long number) {
+      std::unique_lock<std::mutex> guard(lock);
+      while (running.count(number)) changed.wait(guard);
+    }
+
+    void drain() {
+      {
+        std::lock_guard<std::mutex> guard(lock);
+        if (stopping) return;
+        stopping = true;
+      }
+      changed.notify_all();
+      for (unsigned i = 0; i < workers.size(); ++i) workers[i].join();
+    }
+  };
+
+  //a tempid comes back in :tempids as an id in its partition whose low 42
+  //bits hold the negative index it was written with, e.g.
+  //#db/id [:db.part/user -1] as -9223350046622220289. keys already in index
+  //range or given as strings are taken as written
+  long long tempidIndex(edn::EdnNode &key) {
+    long long id = atoll(key.value.c_str());
+    const long long indexBits = 1LL << 42;
+    if (key.type == edn::EdnString || id > -indexBits) return id;
+    return (id & (indexBits - 1)) - indexBits;
+  }
+
+  //:tempids from a transaction result as idx -> entity id
+  std::map<long long, long long> resultTempids(string body) {
+    std::map<long long, long long> ids;
+    edn::EdnNode result = edn::read(body);
+    if (!atPathExists("[:tempids]", result)) return ids;
+    edn::EdnNode tempids = atPath("[:tempids]", result);
+    std::list<edn::EdnNode>::iterator it;
+    for (it = tempids.values.begin(); it != tempids.values.end(); ++it) {
+      long long idx = tempidIndex(*it);
+      if (++it == tempids.values.end()) break;
+      ids[idx] = atoll(it->value.c_str());
+    }
+    return ids;
+  }
+}
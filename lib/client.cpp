@@ -0,0 +1,301 @@
+#include "../vendor/edn-cpp/edn.hpp"
+#include "client.hpp"
+#include <curl/curl.h>
+#include <iostream>
+#include <mutex>
+#include <vector>
+#include <list>
+#include <algorithm>
+#include <stdlib.h>
+
+namespace datomicRest {
+  using std::string;
+  using std::vector;
+  using std::cout;
+  using std::endl;
+
+  namespace {
+    std::once_flag curlInit;
+
+    size_t appendBody(char* buf, size_t size, size_t nmemb, void* up) {
+      ((string*)up)->append(buf, size*nmemb);
+      return size*nmemb;
+    }
+
+#if LIBCURL_VERSION_NUM >= 0x072000
+    int cancelled(void *up, curl_off_t, curl_off_t, curl_off_t, curl_off_t) {
+#else
+    int cancelled(void *up, double, double, double, double) {
+#endif
+      const std::atomic<bool> *flag = (const std::atomic<bool>*)up;
+      return flag && *flag ? 1 : 0;
+    }
+  }
+
+  struct Client::Pool {
+    std::mutex lock;
+    vector<CURL*> idle;
+    size_t maxIdle;
+
+    Pool(size_t max) : maxIdle(max) {
+      std::call_once(curlInit, []() { curl_global_init(CURL_GLOBAL_ALL); });
+    }
+
+    ~Pool() {
+      for (size_t i = 0; i < idle.size(); ++i) curl_easy_cleanup(idle[i]);
+    }
+
+    CURL *acquire() {
+      {
+        std::lock_guard<std::mutex> guard(lock);
+        if (idle.size()) {
+          CURL *handle = idle.back();
+          idle.pop_back();
+          return handle;
+        }
+      }
+      CURL *handle = curl_easy_init();
+      if (!handle) throw "could not open a connection";
+      return handle;
+    }
+
+    //handles keep their connection alive, so returning them reuses it
+    void release(CURL *handle) {
+      curl_easy_reset(handle);
+      std::lock_guard<std::mutex> guard(lock);
+      if (idle.size() < maxIdle) idle.push_back(handle);
+      else curl_easy_cleanup(handle);
+    }
+  };
+
+  Client::Client(ClientConfig config)
+    : settings(std::move(config)), pool(new Pool(settings.maxIdle)) {
+    if (settings.host.length() && *settings.host.rbegin() != '/') settings.host += '/';
+  }
+
+  Client::~Client() {}
+
+  Client::Client(Client &&other)
+    : settings(std::move(other.settings)), pool(std::move(other.pool)) {}
+
+  Client &Client::operator=(Client &&other) {
+    settings = std::move(other.settings);
+    pool = std::move(other.pool);
+    return *this;
+  }
+
+  const ClientConfig &Client::config() const {
+    return settings;
+  }
+
+  string Client::escapeQuotes(const string &str) {
+    string escaped;
+    for (unsigned i = 0; i < str.length(); ++i) {
+      if (str[i] == '"' || str[i] == '\\') escaped += '\\';
+      escaped += str[i];
+    }
+    return escaped;
+  }
+
+  string Client::escapeUrl(const string &value) {
+    char *escaped = curl_easy_escape(NULL, value.c_str(), value.length());
+    string out(escaped);
+    curl_free(escaped);
+    return out;
+  }
+
+  //parse out <title>{string we care about}</title>
+  edn::EdnNode Client::problem(const string &body) {
+    size_t start = body.find("<title>");
+    size_t stop = body.find("</title>");
+    if (start == string::npos || stop == string::npos || stop < start)
+      return edn::read("\"Problem: " + escapeQuotes(body) + "\"");
+    start += 7;
+    return edn::read("\"Problem: " + escapeQuotes(body.substr(start, stop - start)) + "\"");
+  }
+
+  edn::EdnNode Client::request(Method method, const string &url, const string &postData,
+                               const string &acceptHeader,
+                               const std::atomic<bool> *cancel) const {
+    if (!pool) throw "client was moved from";
+
+    CURL *handle = pool->acquire();
+    struct curl_slist *headers = curl_slist_append(NULL, acceptHeader.c_str());
+    string body;
+    string fullUrl = settings.host + url;
+
+    if (method == POST) {
+      curl_easy_setopt(handle, CURLOPT_POST, 1);
+      curl_easy_setopt(handle, CURLOPT_POSTFIELDS, postData.c_str());
+    } else {
+      curl_easy_setopt(handle, CURLOPT_HTTPGET, 1);
+    }
+    curl_easy_setopt(handle, CURLOPT_HTTPHEADER, headers);
+    curl_easy_setopt(handle, CURLOPT_URL, fullUrl.c_str());
+    curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, &appendBody);
+    curl_easy_setopt(handle, CURLOPT_WRITEDATA, &body);
+    curl_easy_setopt(handle, CURLOPT_NOSIGNAL, 1);
+    if (settings.timeoutMs) curl_easy_setopt(handle, CURLOPT_TIMEOUT_MS, settings.timeoutMs);
+    if (cancel) {
+      curl_easy_setopt(handle, CURLOPT_NOPROGRESS, 0);
+#if LIBCURL_VERSION_NUM >= 0x072000
+      curl_easy_setopt(handle, CURLOPT_XFERINFOFUNCTION, &cancelled);
+      curl_easy_setopt(handle, CURLOPT_XFERINFODATA, cancel);
+#else
+      curl_easy_setopt(handle, CURLOPT_PROGRESSFUNCTION, &cancelled);
+      curl_easy_setopt(handle, CURLOPT_PROGRESSDATA, cancel);
+#endif
+    }
+    if (settings.verbose) curl_easy_setopt(handle, CURLOPT_VERBOSE, 1);
+
+    CURLcode code = curl_easy_perform(handle);
+    long responseCode = 0;
+    curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &responseCode);
+    curl_slist_free_all(headers);
+    pool->release(handle);
+
+    if (code == CURLE_ABORTED_BY_CALLBACK) throw "request cancelled";
+    if (code != CURLE_OK) throw curl_easy_strerror(code);
+
+    if (settings.verbose) {
+      cout << "URL: " << fullUrl << endl;
+      cout << "RESPONSE CODE: " << responseCode << endl;
+      cout << "DATA: " << body << endl;
+    }
+
+    if (responseCode == 500) return problem(body);
+    return edn::read(body);
+  }
+
+  string Client::dbArg(const ClientConfig &config) {
+    string arg = "{:db/alias \"" + config.alias + "/" + config.db + "\"";
+    if (config.asOf.length()) arg += " :as-of " + config.asOf;
+    if (config.since.length()) arg += " :since " + config.since;
+    if (config.history) arg += " :history true";
+    return arg + "}";
+  }
+
+  string Client::queryArgs(const string &dbArg, const string &extraArgs) {
+    string args = dbArg;
+    if (extraArgs.length()) {
+      edn::EdnNode extra = edn::read(extraArgs);
+      if (extra.type != edn::EdnVector) throw "args must be an edn vector";
+      std::list<edn::EdnNode>::iterator it;
+      for (it = extra.values.begin(); it != extra.values.end(); ++it)
+        args += " " + edn::pprint(*it);
+    }
+    return "[" + args + "]";
+  }
+
+  string Client::queryPath(const string &queryString, const string &queryArgs) {
+    return "api/query?q=" + escapeUrl(queryString) + "&args=" + escapeUrl(queryArgs);
+  }
+
+  edn::EdnNode Client::query(const string &queryString, const string &extraArgs,
+                             const std::atomic<bool> *cancel) const {
+    if (settings.verbose) cout << "QUERY: " << queryString << endl;
+    return request(GET, queryPath(queryString, queryArgs(dbArg(settings), extraArgs)),
+                   "", "Accept: application/edn", cancel);
+  }
+
+  edn::EdnNode Client::entity(const string &entity) const {
+    string url = "data/" + settings.alias + "/" + settings.db + "/-/entity?e=" + escapeUrl(entity);
+    if (settings.asOf.length()) url += "&as-of=" + escapeUrl(settings.asOf);
+    if (settings.since.length()) url += "&since=" + escapeUrl(settings.since);
+    return request(GET, url);
+  }
+
+  edn::EdnNode Client::transact(const string &txData) const {
+    if (settings.verbose) cout << "TRANSACT: " << txData << endl;
+    return request(POST, "data/" + settings.alias + "/" + settings.db + "/",
+                   "tx-data=" + escapeUrl(txData));
+  }
+
+  edn::EdnNode Client::storages() const {
+    return request(GET, "data/");
+  }
+
+  edn::EdnNode Client::databases() const {
+    return request(GET, "data/" + settings.alias + "/");
+  }
+
+  string Client::attributesQuery(const string &ns) {
+    string name = ns.length() && ns[0] == ':' ? ns.substr(1) : ns;
+    return "[:find ?ident ?valueType ?cardinality "
+           " :where [?e :db/ident ?ident] "
+                  " [(namespace ?ident) ?ns] "
+                  " [(= ?ns \"" + escapeQuotes(name) + "\")] "
+                  " [?e :db/valueType ?v] "
+                  " [?v :db/ident ?valueType] "
+                  " [?e :db/cardinality ?c] "
+                  " [?c :db/ident ?cardinality]]";
+  }
+
+  string Client::identsQuery(const string &ns) {
+    string name = ns.length() && ns[0] == ':' ? ns.substr(1) : ns;
+    return "[:find ?ident "
+           " :where [_ :db/ident ?ident] "
+                  " [(namespace ?ident) ?ns] "
+                  " [(= ?ns \"" + escapeQuotes(name) + "\")]]";
+  }
+
+  string Client::fnsQuery() {
+    return "[:find ?fn :where [?f :db/fn _] [?f :db/ident ?fn]]";
+  }
+
+  edn::EdnNode Client::attributes(const string &ns) const {
+    return query(attributesQuery(ns));
+  }
+
+  edn::EdnNode Client::idents(const string &ns) const {
+    return query(identsQuery(ns));
+  }
+
+  edn::EdnNode Client::fns() const {
+    return query(fnsQuery());
+  }
+
+  edn::EdnNode Client::header(const string &queryString) {
+    string qheader = "[";
+    edn::EdnNode qedn = edn::read(queryString);
+    std::list<edn::EdnNode>::iterator it;
+    for (it = qedn.values.begin(); it != qedn.values.end(); ++it) {
+      if (it->type == edn::EdnKeyword && it->value == ":find") continue;
+      if (it->type == edn::EdnKeyword) break;
+      qheader += " \"" + escapeQuotes(edn::pprint(*it)) + "\"";
+    }
+    qheader.erase(std::remove(qheader.begin(), qheader.end(), '\n'), qheader.end());
+    return edn::read(qheader + "]");
+  }
+
+  edn::EdnNode Client::atPath(const string &pathStr, edn::EdnNode &&result) {
+    edn::EdnNode path = edn::read(pathStr);
+    std::list<edn::EdnNode>::iterator it;
+    for (it = path.values.begin(); it != path.values.end(); ++it) {
+      std::list<edn::EdnNode>::iterator found = result.values.end();
+      if (result.type == edn::EdnMap) {
+        std::list<edn::EdnNode>::iterator kit = result.values.begin();
+        while (kit != result.values.end()) {
+          std::list<edn::EdnNode>::iterator vit = kit;
+          if (++vit == result.values.end()) break;
+          if (kit->value == it->value) {
+            found = vit;
+            break;
+          }
+          kit = ++vit;
+        }
+      } else if (it->type == edn::EdnInt) {
+        long index = atol(it->value.c_str());
+        if (index >= 0 && size_t(index) < result.values.size()) {
+          found = result.values.begin();
+          std::advance(found, index);
+        }
+      }
+
+      if (found == result.values.end()) throw "Could not find item in path";
+      edn::EdnNode next = std::move(*found);
+      result = std::move(next);
+    }
+    return std::move(result);
+  }
+}
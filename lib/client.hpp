@@ -0,0 +1,107 @@
+#ifndef DTM_CLIENT_HPP
+#define DTM_CLIENT_HPP
+
+#include <string>
+#include <memory>
+#include <atomic>
+
+//declarations only, so any number of translation units and threads can share
+//one Client. definitions live in client.cpp and build into libdtm. expects
+//vendor/edn-cpp/edn.hpp to be included first, as datomicRest.hpp does.
+//libdtm builds with hidden visibility and exports only what is marked
+//DTM_API, so the edn globals every includer defines are never shared with
+//the program and get constructed and destroyed once per copy
+#define DTM_API __attribute__((visibility("default")))
+
+namespace datomicRest {
+
+  struct ClientConfig {
+    std::string host;
+    std::string alias;
+    std::string db;
+
+    //basis for reads, empty for the current database
+    std::string asOf;
+    std::string since;
+    bool history;
+
+    //idle connections kept for reuse, requests beyond it open new ones
+    size_t maxIdle;
+    long timeoutMs;
+    bool verbose;
+
+    ClientConfig() : history(false), maxIdle(8), timeoutMs(0), verbose(false) {}
+  };
+
+  //owns its configuration and a pool of connections. every request borrows a
+  //connection for its duration, so calls from many threads run concurrently
+  //and nothing is shared between clients. results are returned by value and
+  //moved out, never copied through a shared buffer
+  class DTM_API Client {
+   public:
+    enum Method { GET, POST };
+
+    explicit Client(ClientConfig config);
+    ~Client();
+
+    Client(Client &&other);
+    Client &operator=(Client &&other);
+    Client(const Client &) = delete;
+    Client &operator=(const Client &) = delete;
+
+    const ClientConfig &config() const;
+
+    //500 responses come back as a "Problem: ..." string, transport errors
+    //throw. a set cancel flag aborts the request mid transfer
+    edn::EdnNode request(Method method, const std::string &url,
+                         const std::string &postData = "",
+                         const std::string &acceptHeader = "Accept: application/edn",
+                         const std::atomic<bool> *cancel = NULL) const;
+
+    //extraArgs is an edn vector of inputs bound after $ e.g. ["foo" 42]
+    edn::EdnNode query(const std::string &queryString,
+                       const std::string &extraArgs = "",
+                       const std::atomic<bool> *cancel = NULL) const;
+
+    edn::EdnNode entity(const std::string &entity) const;
+    edn::EdnNode transact(const std::string &txData) const;
+    edn::EdnNode storages() const;
+    edn::EdnNode databases() const;
+    edn::EdnNode attributes(const std::string &ns) const;
+    edn::EdnNode idents(const std::string &ns) const;
+    edn::EdnNode fns() const;
+
+    //the :find elements of a query as a vector of strings
+    static edn::EdnNode header(const std::string &queryString);
+
+    //walks [0 :key ...] into result, moving the found node out of it
+    static edn::EdnNode atPath(const std::string &pathStr, edn::EdnNode &&result);
+
+    //the pieces datomicRest.hpp builds its global requests from, kept here
+    //so the binaries and the library share one implementation
+
+    //"Problem: <title of the error page>"
+    static edn::EdnNode problem(const std::string &body);
+    static std::string escapeQuotes(const std::string &value);
+    static std::string escapeUrl(const std::string &value);
+
+    //the db input as a map, carrying :as-of :since and :history when set
+    static std::string dbArg(const ClientConfig &config);
+
+    //[db extra...] where extraArgs is an edn vector or empty
+    static std::string queryArgs(const std::string &dbArg, const std::string &extraArgs);
+    static std::string queryPath(const std::string &queryString, const std::string &queryArgs);
+
+    static std::string attributesQuery(const std::string &ns);
+    static std::string identsQuery(const std::string &ns);
+    static std::string fnsQuery();
+
+   private:
+    struct Pool;
+
+    ClientConfig settings;
+    std::unique_ptr<Pool> pool;
+  };
+}
+
+#endif
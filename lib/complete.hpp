@@ -0,0 +1,139 @@
+#include <mutex>
+#include <thread>
+#include <memory>
+#include <condition_variable>
+#include <chrono>
+
+namespace datomicRest {
+
+  //sorted, de-duplicated words answering prefix lookups with a binary
+  //search. the word list is swapped whole so lookups never wait on a reload
+  class PrefixIndex {
+    std::shared_ptr<const vector<string> > words;
+    std::mutex lock;
+
+   public:
+    PrefixIndex() : words(new vector<string>()) {}
+
+    void reset(vector<string> &fresh) {
+      std::sort(fresh.begin(), fresh.end());
+      fresh.erase(std::unique(fresh.begin(), fresh.end()), fresh.end());
+      vector<string> *next = new vector<string>();
+      next->swap(fresh);
+      std::shared_ptr<const vector<string> > built(next);
+      std::lock_guard<std::mutex> guard(lock);
+      words = built;
+    }
+
+    std::shared_ptr<const vector<string> > snapshot() {
+      std::lock_guard<std::mutex> guard(lock);
+      return words;
+    }
+
+    vector<string> lookup(const string &prefix, size_t max = 1000) {
+      std::shared_ptr<const vector<string> > current = snapshot();
+      vector<string> matches;
+      vector<string>::const_iterator it =
+        std::lower_bound(current->begin(), current->end(), prefix);
+      for (; it != current->end() && matches.size() < max; ++it) {
+        if (it->compare(0, prefix.length(), prefix) != 0) break;
+        matches.push_back(*it);
+      }
+      return matches;
+    }
+  };
+
+  //keeps a PrefixIndex of every ident (attributes, enums and fns) plus a
+  //fixed list of commands, reloading it on its own curl handle every
+  //refreshSeconds so the repl connection is never shared across threads
+  class IdentCompleter {
+    PrefixIndex index;
+    vector<string> commands;
+    int refreshSeconds;
+    bool stopping;
+    bool refreshRequested;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::thread worker;
+
+    void load(CURL *handle) {
+      char *q = curl_easy_escape(handle, "[:find ?ident :where [_ :db/ident ?ident]]", 0);
+      char *a = curl_easy_escape(handle, queryArgs().c_str(), 0);
+      string url = "api/query?q=" + string(q) + "&args=" + string(a);
+      curl_free(q);
+      curl_free(a);
+
+      string body;
+      long responseCode = 0;
+      try {
+        responseCode = perform(GET, url, "", "Accept: application/edn",
+                               &appendCallback, &body, handle);
+      } catch (const char* e) {
+        return;
+      }
+      if (responseCode != 200) return;
+
+      vector<string> words(commands);
+      try {
+        edn::EdnNode result = edn::read(body);
+        std::list<edn::EdnNode>::iterator it;
+        for (it = result.values.begin(); it != result.values.end(); ++it)
+          if (it->values.size()) words.push_back(it->values.front().value);
+      } catch (const char* e) {
+        return;
+      }
+      index.reset(words);
+    }
+
+    void run() {
+      CURL *handle = curl_easy_init();
+      std::unique_lock<std::mutex> guard(lock);
+      while (!stopping) {
+        guard.unlock();
+        load(handle);
+        guard.lock();
+        //a refresh asked for while loading is still pending here
+        if (!refreshRequested)
+          wake.wait_for(guard, std::chrono::seconds(refreshSeconds),
+                        [this]() { return stopping || refreshRequested; });
+        refreshRequested = false;
+      }
+      curl_easy_cleanup(handle);
+    }
+
+   public:
+    IdentCompleter(vector<string> &commandNames, int refresh = 300)
+      : commands(commandNames), refreshSeconds(refresh), stopping(false),
+        refreshRequested(false) {
+      vector<string> initial(commands);
+      index.reset(initial);
+    }
+
+    ~IdentCompleter() { stop(); }
+
+    void start() {
+      worker = std::thread(&IdentCompleter::run, this);
+    }
+
+    void refresh() {
+      {
+        std::lock_guard<std::mutex> guard(lock);
+        refreshRequested = true;
+      }
+      wake.notify_one();
+    }
+
+    void stop() {
+      {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+      }
+      wake.notify_one();
+      if (worker.joinable()) worker.join();
+    }
+
+    vector<string> complete(const string &prefix) {
+      return index.lookup(prefix);
+    }
+  };
+}
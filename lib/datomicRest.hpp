@@ -1,4 +1,5 @@
 #include "trim.hpp"
+#include "client.hpp"
 #include <curl/curl.h>
 #include <string>
 #include <iostream>
@@ -7,7 +8,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <algorithm>
+#include <cmath>
+#include <cctype>
 #include <vector>
+#include <sys/time.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
 
 
 namespace datomicRest {
@@ -28,21 +35,31 @@ namespace datomicRest {
   enum FormatTypes { EDN, TBL, JSON, CSV, TSV };
   FormatTypes format = TBL;
   
-  string data;
+  //per thread so background requests each have their own connection,
+  //response buffer and header
+  thread_local string data;
   string host;
   string alias;
   string db;
+
+  //basis for reads, empty for the current database
+  string asOf;
+  string since;
+  bool history = false;
     
   int queryLimit;
   int queryOffset;
-  edn::EdnNode queryHeader;
+  thread_local edn::EdnNode queryHeader;
   
   bool validate = false;
   bool verbose = false;
   bool watchingEvents = false;
   void (*watchingEventsHandler)(bool, edn::EdnNode);
   
-  CURL *curl;
+  thread_local CURL *curl;
+
+  //a request in flight aborts as soon as the calling thread's flag is set
+  thread_local std::atomic<bool> *cancelFlag = NULL;
 
   FormatTypes getFormatType(string str) {
     if (str == "EDN" || str == "edn")
@@ -70,6 +87,16 @@ namespace datomicRest {
     return format;
   }
 
+  string escapeString(string str) {
+    return Client::escapeQuotes(str);
+  }
+
+  double nowMs() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+  }
+
   //write to some sort of log file?
   std::string exec(char* cmd) {
     FILE* pipe = popen(cmd, "r");
@@ -95,7 +122,43 @@ namespace datomicRest {
     curl = curl_easy_init();
   }
   
+  //requests go through one Client described by the settings above. it is
+  //replaced when they change, callers keep the one they started with
+  std::shared_ptr<Client> sharedClient;
+  std::mutex sharedClientLock;
+
+  ClientConfig clientConfig(string asOfT, string sinceT, bool withHistory) {
+    ClientConfig config;
+    config.host = host;
+    config.alias = alias;
+    config.db = db;
+    config.asOf = asOfT;
+    config.since = sinceT;
+    config.history = withHistory;
+    config.verbose = verbose;
+    return config;
+  }
+
+  std::shared_ptr<Client> client() {
+    ClientConfig config = clientConfig(asOf, since, history);
+    std::lock_guard<std::mutex> guard(sharedClientLock);
+    if (sharedClient) {
+      const ClientConfig &current = sharedClient->config();
+      if (current.host == config.host && current.alias == config.alias &&
+          current.db == config.db && current.asOf == config.asOf &&
+          current.since == config.since && current.history == config.history &&
+          current.verbose == config.verbose)
+        return sharedClient;
+    }
+    sharedClient = std::make_shared<Client>(config);
+    return sharedClient;
+  }
+
   void cleanup(string msg = "") {
+    {
+      std::lock_guard<std::mutex> guard(sharedClientLock);
+      sharedClient.reset();
+    }
     curl_easy_cleanup(curl); 
     curl_global_cleanup(); 
   }
@@ -119,47 +182,101 @@ namespace datomicRest {
     return size*nmemb;
   }
 
-  edn::EdnNode request(ReqTypes reqType, 
-                       string url, 
-                       string postData = "", 
-                       string acceptHeader = "Accept: application/edn") {
+  size_t appendCallback(char* buf, size_t size, size_t nmemb, void* up) {
+    ((string*)up)->append(buf, size*nmemb);
+    return size*nmemb;
+  }
+
+#if LIBCURL_VERSION_NUM >= 0x072000
+  int cancelCallback(void *up, curl_off_t, curl_off_t, curl_off_t, curl_off_t) {
+#else
+  int cancelCallback(void *up, double, double, double, double) {
+#endif
+    std::atomic<bool> *flag = (std::atomic<bool>*)up;
+    return flag && *flag ? 1 : 0;
+  }
+
+  typedef size_t (*WriteFn)(char*, size_t, size_t, void*);
+
+  long perform(ReqTypes reqType,
+               string url,
+               string postData,
+               string acceptHeader,
+               WriteFn writeFn,
+               void *writeData = NULL,
+               CURL *handle = NULL) {
+    if (handle == NULL) handle = curl;
     struct curl_slist *headers = NULL;
     headers = curl_slist_append(headers, acceptHeader.c_str());
 
-    data = "";
-    
     if (reqType == POST) {
-      curl_easy_setopt(curl, CURLOPT_POST, 1);
+      curl_easy_setopt(handle, CURLOPT_POST, 1);
       if(postData.length()) {
-        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, postData.c_str());
+        curl_easy_setopt(handle, CURLOPT_POSTFIELDS, postData.c_str());
       }
     }
     else {
-      curl_easy_setopt(curl, CURLOPT_HTTPGET, 1);
+      curl_easy_setopt(handle, CURLOPT_HTTPGET, 1);
     }
 
     string fullHost = host + url;
-    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-    curl_easy_setopt(curl, CURLOPT_URL, fullHost.c_str());
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, &writeCallback);
-    if (verbose) curl_easy_setopt(curl, CURLOPT_VERBOSE, 1); 
-    curl_easy_perform(curl); 
+    curl_easy_setopt(handle, CURLOPT_HTTPHEADER, headers);
+    curl_easy_setopt(handle, CURLOPT_URL, fullHost.c_str());
+    curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, writeFn);
+    curl_easy_setopt(handle, CURLOPT_WRITEDATA, writeData);
+    //requests run on several threads at once, keep curl off signals
+    curl_easy_setopt(handle, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(handle, CURLOPT_NOPROGRESS, 0);
+#if LIBCURL_VERSION_NUM >= 0x072000
+    curl_easy_setopt(handle, CURLOPT_XFERINFOFUNCTION, &cancelCallback);
+    curl_easy_setopt(handle, CURLOPT_XFERINFODATA, cancelFlag);
+#else
+    curl_easy_setopt(handle, CURLOPT_PROGRESSFUNCTION, &cancelCallback);
+    curl_easy_setopt(handle, CURLOPT_PROGRESSDATA, cancelFlag);
+#endif
+    if (verbose) curl_easy_setopt(handle, CURLOPT_VERBOSE, 1); 
+    CURLcode code = curl_easy_perform(handle); 
+    curl_slist_free_all(headers);
+    if (code == CURLE_ABORTED_BY_CALLBACK) throw "request cancelled";
 
     long responseCode;
-    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &responseCode);
+    curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &responseCode);
 
     if (verbose) { 
       cout << "URL: " << fullHost << endl;
       cout << "RESPONSE CODE: " << responseCode << endl;
-      cout << "DATA: " << data << endl;
     }
 
+    return responseCode;
+  }
+
+  edn::EdnNode problem(string body) {
+    return Client::problem(body);
+  }
+
+  edn::EdnNode request(ReqTypes reqType, 
+                       string url, 
+                       string postData = "", 
+                       string acceptHeader = "Accept: application/edn") {
+    //transport errors read like a server problem, cancelling still throws
+    if (!watchingEvents) {
+      try {
+        return client()->request(reqType == POST ? Client::POST : Client::GET,
+                                 url, postData, acceptHeader, cancelFlag);
+      } catch (const char* e) {
+        if (string(e) == "request cancelled") throw;
+        return problem(e);
+      }
+    }
+
+    //events hand each chunk to watchingEventsHandler as it arrives
+    data = "";
+    long responseCode = perform(reqType, url, postData, acceptHeader, &writeCallback);
+
+    if (verbose) cout << "DATA: " << data << endl;
+
     if(responseCode == 500) { 
-      //parse out <title>{string we care about}</title>
-      size_t start = data.find("<title>") + 7; 
-      size_t stop = data.find("</title>") - 8; 
-      size_t len = stop - start; 
-      return edn::read("\"Problem: " + data.substr(start, len) + "\""); 
+      return problem(data);
     } else { 
       return edn::read(data);
     }
@@ -185,11 +302,28 @@ namespace datomicRest {
     char *entityId = curl_easy_escape(curl, entity.c_str(), 0);
     string url = "data/" + alias + "/" + db + "/-/entity?e=" + string(entityId);
     curl_free(entityId);
+    if (asOf.length()) {
+      char *t = curl_easy_escape(curl, asOf.c_str(), 0);
+      url += "&as-of=" + string(t);
+      curl_free(t);
+    }
+    if (since.length()) {
+      char *t = curl_easy_escape(curl, since.c_str(), 0);
+      url += "&since=" + string(t);
+      curl_free(t);
+    }
     return request(GET, url);
   }
   
+  //checks tx data against the cached schema, see validate.hpp
+  edn::EdnNode validateTx(string txData);
+
   edn::EdnNode transact(string transactString) {
     if (verbose) cout << "TRANSACT: " << transactString << endl;
+    if (validate) {
+      edn::EdnNode invalid = validateTx(transactString);
+      if (invalid.type != edn::EdnNil) return invalid;
+    }
     char *txdata = curl_easy_escape(curl, transactString.c_str(), 0);
     string data = "tx-data=" + string(txdata);
     if (verbose) cout << "DATA: " << data << endl;
@@ -213,6 +347,8 @@ namespace datomicRest {
     return transact("[" + retractions + "]");
   }
   
+  edn::EdnNode query(string queryString, string extraArgs = "");
+
   edn::EdnNode schema(string ns) {
     return query("[:find ?val :where [ "
     " ((fn [db] "
@@ -228,35 +364,30 @@ namespace datomicRest {
 		                             
   }
   
-  edn::EdnNode query(string queryString) {
+  //extraArgs is an edn vector of inputs bound after $ e.g. ["foo" 42]
+  //the db input as a map, carrying :as-of :since and :history when set
+  string dbArgAt(string asOfT, string sinceT, bool withHistory) {
+    return Client::dbArg(clientConfig(asOfT, sinceT, withHistory));
+  }
+
+  string queryArgs(string extraArgs = "", string dbArg = "") {
+    return Client::queryArgs(dbArg.length() ? dbArg : dbArgAt(asOf, since, history), extraArgs);
+  }
+
+  //sets queryHeader from the :find clause and returns the api/query url
+  string queryUrl(string queryString, string extraArgs = "", string dbArg = "") {
     if (verbose) cout << "QUERY: " << queryString << endl;
     if (verbose) cout << "CONN:  " << host << " | " << alias << " | " << db << endl;
     try {
-      string qheader = "[";
-      edn::EdnNode qedn = edn::read(queryString);
-      std::list<edn::EdnNode>::iterator qit;
-      //iterate over list expecting first node to be :find until next :keyword
-      for (qit = qedn.values.begin(); qit != qedn.values.end(); ++qit) {
-        if (qit->type == edn::EdnKeyword && qit->value == ":find") continue;
-        if (qit->type == edn::EdnKeyword) break;
-        qheader += " \"" + edn::pprint(*qit) + "\"";
-      }
-      qheader.erase(
-        std::remove(qheader.begin(), qheader.end(), '\n'), 
-        qheader.end());
-      
-      queryHeader = edn::read(qheader + "]");
-
+      queryHeader = Client::header(queryString);
     } catch (const char* e) {
       throw "Could not parse query: " + string(e);
     }
-    
-    char *query = curl_easy_escape(curl, queryString.c_str(), 0);
-    char *args = curl_easy_escape(curl, string("[{:db/alias \"" + alias + "/" + db + "\"}]").c_str(), 0);
-    string url = "api/query?q=" + string(query) + "&args=" + string(args);
-    curl_free(query);
-    curl_free(args);
-    return request(GET, url);
+    return Client::queryPath(queryString, queryArgs(extraArgs, dbArg));
+  }
+
+  edn::EdnNode query(string queryString, string extraArgs) {
+    return request(GET, queryUrl(queryString, extraArgs));
   }
 
   edn::EdnNode getEntitiesWith(edn::EdnNode attrs) {
@@ -308,26 +439,15 @@ namespace datomicRest {
   }
     
   edn::EdnNode getIdents(string ns) { 
-    return query(
-      "[:find ?ident "
-      " :where [_ :db/ident ?ident] "
-             " [(namespace ?ident) ?ns] "
-             " [(= ?ns \"" + getJustNamespace(ns) + "\")]]");
+    return query(Client::identsQuery(ns));
   }
   
   edn::EdnNode getFns() {
-    return query("[:find ?fn :where [?f :db/fn _] [?f :db/ident ?fn]]");
+    return query(Client::fnsQuery());
   }
   
   edn::EdnNode getAttributes(string ns) {
-    return query("[:find ?ident ?valueType ?cardinality "
-                 " :where [?e :db/ident ?ident] "
-                        " [(namespace ?ident) ?ns] "
-                        " [(= ?ns \"" + getJustNamespace(ns) + "\")] "
-                        " [?e :db/valueType ?v] " 
-                        " [?v :db/ident ?valueType] " 
-                        " [?e :db/cardinality ?c] "
-                        " [?c :db/ident ?cardinality]]");  
+    return query(Client::attributesQuery(ns));
   }
 
   edn::EdnNode getEntities(string ns) {
@@ -348,6 +468,106 @@ namespace datomicRest {
     return query(findClause + whereClause + "]");
   }
   
+  bool validUuid(string val) {
+    if (val.length() != 36) return false;
+    for (unsigned i = 0; i < val.length(); ++i) {
+      if (i == 8 || i == 13 || i == 18 || i == 23) {
+        if (val[i] != '-') return false;
+      } else if (!isxdigit(val[i])) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  //accepts yyyy-mm-dd with an optional Thh:mm[:ss[.sss]] and offset or Z
+  bool validInstant(string val) {
+    if (val.length() < 10) return false;
+    for (unsigned i = 0; i < 10; ++i) {
+      if (i == 4 || i == 7) {
+        if (val[i] != '-') return false;
+      } else if (!isdigit(val[i])) {
+        return false;
+      }
+    }
+    if (val.length() == 10) return true;
+    if (val[10] != 'T') return false;
+    return val.find_first_not_of("0123456789:.+-TZ", 10) == string::npos;
+  }
+
+  //turns a raw field into edn text for a :db.type/*, false if it doesn't fit
+  //[+-]digits[.digits][e[+-]digits] up to length, no inf, nan or hex that
+  //strtod would take but edn can not read back
+  bool decimalText(const string &val, size_t length) {
+    size_t i = 0;
+    if (i < length && (val[i] == '-' || val[i] == '+')) i++;
+    size_t digits = i;
+    while (i < length && isdigit((unsigned char)val[i])) i++;
+    if (i == digits) return false;
+    if (i < length && val[i] == '.') {
+      digits = ++i;
+      while (i < length && isdigit((unsigned char)val[i])) i++;
+      if (i == digits) return false;
+    }
+    if (i < length && (val[i] == 'e' || val[i] == 'E')) {
+      i++;
+      if (i < length && (val[i] == '-' || val[i] == '+')) i++;
+      digits = i;
+      while (i < length && isdigit((unsigned char)val[i])) i++;
+      if (i == digits) return false;
+    }
+    return i == length;
+  }
+
+  bool coerceValue(string val, string ednType, string &out) {
+    char *end = NULL;
+    if (ednType == ":db.type/string") {
+      out = "\"" + escapeString(val) + "\"";
+      return true;
+    }
+    if (!val.length()) return false;
+
+    if (ednType == ":db.type/boolean") {
+      if (val != "true" && val != "false") return false;
+      out = val;
+    } else if (ednType == ":db.type/long" || ednType == ":db.type/bigint") {
+      strtoll(val.c_str(), &end, 10);
+      if (*end != 0 && !(*end == 'N' && end[1] == 0)) return false;
+      out = val;
+    } else if (ednType == ":db.type/double" || ednType == ":db.type/float") {
+      if (!decimalText(val, val.length())) return false;
+      double number = strtod(val.c_str(), &end);
+      if (std::isinf(number)) return false;
+      out = val;
+      if (out.find_first_of(".eE") == string::npos) out += ".0";
+    } else if (ednType == ":db.type/bigdec") {
+      bool suffixed = *val.rbegin() == 'M';
+      if (!decimalText(val, val.length() - (suffixed ? 1 : 0))) return false;
+      out = suffixed ? val : val + "M";
+    } else if (ednType == ":db.type/instant") {
+      if (!validInstant(val)) return false;
+      out = "#inst \"" + val + "\"";
+    } else if (ednType == ":db.type/uuid") {
+      if (!validUuid(val)) return false;
+      out = "#uuid \"" + val + "\"";
+    } else if (ednType == ":db.type/keyword") {
+      out = val[0] == ':' ? val : ":" + val;
+      if (out.find_first_of(" \t\n\",[]{}()") != string::npos) return false;
+    } else if (ednType == ":db.type/ref") {
+      //an entity id, an ident or a lookup ref e.g. [:user/email "a@b.c"]
+      strtoll(val.c_str(), &end, 10);
+      if (*end == 0) out = val;
+      else if (val[0] == ':') out = val;
+      else if (val[0] == '[' && *val.rbegin() == ']') out = val;
+      else return false;
+    } else if (ednType == ":db.type/uri") {
+      out = "#uri \"" + escapeString(val) + "\"";
+    } else {
+      return false;
+    }
+    return true;
+  }
+
   bool validEdn(string val, string ednType, edn::EdnNode &node) {
     if (ednType == ":db.type/string") {
       node.value = val; 
@@ -361,50 +581,21 @@ namespace datomicRest {
       return true;
     } 
 
+    string coerced;
+    if (coerceValue(val, ednType, coerced)) {
+      try {
+        node = edn::read(coerced);
+        return true;
+      } catch (const char* e) {
+        return false;
+      }
+    }
+
     return false;
   }
   
   edn::EdnNode atPath(string pathStr, edn::EdnNode result) { 
-    edn::EdnNode path = edn::read(pathStr);
-    std::list<edn::EdnNode>::iterator it;
-    for (it = path.values.begin(); it != path.values.end(); ++it) {
-      bool found = false; 
-      if (result.type == edn::EdnMap) {
-        std::list<edn::EdnNode>::iterator kit;
-        for (kit = result.values.begin(); kit != result.values.end(); ++kit) {
-          if (kit->value == it->value) {
-            kit++;
-            found = true;
-            break;
-          }
-          ++kit;
-        }
-        if (found) {
-          edn::EdnNode newResult = *kit;
-          result = newResult;
-        }
-      } else if (it->type == edn::EdnInt) {
-        std::list<edn::EdnNode>::iterator lit;
-        int index = 0;
-        int matchIndex = atoi(it->value.c_str());
-        for (lit = result.values.begin(); lit != result.values.end(); ++lit) {
-          if (index == matchIndex) {
-            found = true;
-            break;
-          }
-          index++;
-        }
-        if (found) { 
-          edn::EdnNode newResult = *lit;
-          result = newResult;
-        }
-     }
-      
-     if (!found) 
-      throw "Could not find item " + it->value + " in " + result.value;
-    }
-   
-    return result;
+    return Client::atPath(pathStr, std::move(result));
   }
   
   bool atPathExists(string pathStr, edn::EdnNode result) {
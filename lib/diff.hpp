@@ -0,0 +1,89 @@
+#include <unordered_map>
+#include <functional>
+
+namespace datomicRest {
+
+  //rows of both sides meet in one hash table split into shards: the from
+  //side adds one, the to side subtracts one and a row seen on both sides is
+  //dropped as soon as its second copy arrives. what is left at the end is the
+  //difference. the server returns rows in no particular order, so a row can
+  //wait for its copy until the other side is nearly done and memory can
+  //reach the size of the result, not just of the change
+  class RowDiff {
+    static const int shardCount = 16;
+    std::unordered_map<string, int> shards[shardCount];
+    std::mutex locks[shardCount];
+
+   public:
+    void add(string key, int side) {
+      size_t shard = std::hash<string>()(key) % shardCount;
+      std::lock_guard<std::mutex> guard(locks[shard]);
+      std::unordered_map<string, int>::iterator it = shards[shard].find(key);
+      if (it == shards[shard].end()) {
+        shards[shard][key] = side;
+      } else if ((it->second += side) == 0) {
+        shards[shard].erase(it);
+      }
+    }
+
+    //removed rows were only in from, added rows only in to
+    void result(vector<string> &removed, vector<string> &added) {
+      for (int i = 0; i < shardCount; ++i) {
+        std::unordered_map<string, int>::iterator it;
+        for (it = shards[i].begin(); it != shards[i].end(); ++it)
+          (it->second > 0 ? removed : added).push_back(it->first);
+      }
+      std::sort(removed.begin(), removed.end());
+      std::sort(added.begin(), added.end());
+    }
+  };
+
+  class DiffSide : public RowSink {
+    RowDiff &diff;
+    int side;
+
+   public:
+    DiffSide(RowDiff &rowDiff, int rowSide) : diff(rowDiff), side(rowSide) {}
+
+    void row(edn::EdnNode &row) {
+      string key = edn::pprint(row);
+      key.erase(std::remove(key.begin(), key.end(), '\n'), key.end());
+      diff.add(key, side);
+    }
+  };
+
+  //runs the query against both basis points at once, each on its own
+  //connection, and reports the rows added and removed between them. an
+  //empty toT means the current database
+  edn::EdnNode diffQuery(string queryString, string extraArgs, string fromT, string toT) {
+    string fromUrl = queryUrl(queryString, extraArgs, dbArgAt(fromT, "", false));
+    string toUrl = queryUrl(queryString, extraArgs, dbArgAt(toT, "", false));
+
+    RowDiff diff;
+    DiffSide fromSide(diff, 1);
+    DiffSide toSide(diff, -1);
+    edn::EdnNode fromResult;
+    edn::EdnNode toResult;
+
+    CURL *fromHandle = curl;
+    CURL *toHandle = curl_easy_init();
+    std::thread fromThread([&]() { fromResult = streamRequest(fromUrl, fromSide, fromHandle); });
+    std::thread toThread([&]() { toResult = streamRequest(toUrl, toSide, toHandle); });
+    fromThread.join();
+    toThread.join();
+    curl_easy_cleanup(toHandle);
+
+    if (fromResult.type != edn::EdnNil) return fromResult;
+    if (toResult.type != edn::EdnNil) return toResult;
+
+    vector<string> removed;
+    vector<string> added;
+    diff.result(removed, added);
+
+    string out = "{:from " + fromT + " :to " + (toT.length() ? toT : "nil") + " :added [";
+    for (unsigned i = 0; i < added.size(); ++i) out += added[i] + " ";
+    out += "] :removed [";
+    for (unsigned i = 0; i < removed.size(); ++i) out += removed[i] + " ";
+    return edn::read(out + "]}");
+  }
+}
@@ -0,0 +1,221 @@
+#include <memory>
+
+namespace datomicRest {
+
+  //one attribute's datoms in AEVT order, so entity ids arrive ascending. the
+  //queue is small and pushes sleep while it is full, which holds each scan
+  //to roughly the pace of the merge
+  class AttributeScan : public RowSink {
+    SpscQueue<edn::EdnNode> datoms;
+
+   public:
+    string ident;
+    bool many;
+    edn::EdnNode result;
+
+    AttributeScan(string attr, bool cardinalityMany)
+      : datoms(1024), ident(attr), many(cardinalityMany) {
+      result = edn::read("nil");
+    }
+
+    void row(edn::EdnNode &datom) {
+      datoms.pushWait(datom);
+    }
+
+    //called by the scan's thread once result is set, so an exhausted scan
+    //can be told apart from a failed one
+    void finish(edn::EdnNode scanResult) {
+      result = scanResult;
+      datoms.close();
+    }
+
+    //the merge is done with this scan, pushes stop waiting
+    void stop() { datoms.close(); }
+
+    bool failed() { return result.type != edn::EdnNil; }
+
+    //sleeps until the next datom, false once the scan has ended
+    bool next(edn::EdnNode &datom) {
+      return datoms.popWait(datom);
+    }
+  };
+
+  //:e and :v of a datom map
+  bool datomParts(edn::EdnNode &datom, long long &e, edn::EdnNode &v) {
+    bool found = false;
+    std::list<edn::EdnNode>::iterator it = datom.values.begin();
+    while (it != datom.values.end()) {
+      std::list<edn::EdnNode>::iterator value = it;
+      if (++value == datom.values.end()) break;
+      if (it->value == ":e") found = scanLong(value->value, e);
+      else if (it->value == ":v") v = std::move(*value);
+      it = ++value;
+    }
+    return found;
+  }
+
+  //the basis t of the current db, so every scan reads the same snapshot
+  string currentBasis() {
+    edn::EdnNode info = request(GET, "data/" + alias + "/" + db + "/-/");
+    if (atPathExists("[:basis-t]", info)) return atPath("[:basis-t]", info).value;
+    return "-";
+  }
+
+  string datomsUrl(string basis, string attr) {
+    char *a = curl_easy_escape(curl, attr.c_str(), 0);
+    string url = "data/" + alias + "/" + db + "/" + basis +
+                 "/datoms?index=aevt&limit=-1&a=" + string(a);
+    curl_free(a);
+    if (asOf.length()) {
+      char *t = curl_easy_escape(curl, asOf.c_str(), 0);
+      url += "&as-of=" + string(t);
+      curl_free(t);
+    }
+    if (since.length()) {
+      char *t = curl_easy_escape(curl, since.c_str(), 0);
+      url += "&since=" + string(t);
+      curl_free(t);
+    }
+    return url;
+  }
+
+  //every entity with any attribute of ns as one row [id value ...] in entity
+  //id order. each attribute is an AEVT datom scan on its own connection and
+  //the scans are merged on entity id as they stream, so memory is bounded
+  //by the scan queues rather than by the number of entities. attributes an
+  //entity lacks are nil and cardinality many values are sets
+  edn::EdnNode streamEntities(string ns, RowSink &sink) {
+    edn::EdnNode attributes = getAttributes(ns);
+    if (attributes.type == edn::EdnString) return attributes;
+
+    //history has to keep every assertion and retraction, the join does that
+    if (history) {
+      edn::EdnNode result = getEntities(ns);
+      if (result.type == edn::EdnString) return result;
+      std::list<edn::EdnNode>::iterator it;
+      for (it = result.values.begin(); it != result.values.end(); ++it) sink.row(*it);
+      sink.done();
+      return edn::read("nil");
+    }
+
+    string basis = asOf.length() ? "-" : currentBasis();
+    vector<std::unique_ptr<AttributeScan> > scans;
+    string header = "[\"db/id\"";
+    std::list<edn::EdnNode>::iterator ait;
+    for (ait = attributes.values.begin(); ait != attributes.values.end(); ++ait) {
+      vector<edn::EdnNode> attr(ait->values.begin(), ait->values.end());
+      if (attr.size() < 3) continue;
+      scans.push_back(std::unique_ptr<AttributeScan>(
+        new AttributeScan(attr[0].value, attr[2].value == ":db.cardinality/many")));
+      header += " \"" + attr[0].value + "\"";
+    }
+    queryHeader = edn::read(header + "]");
+
+    //set when the merge ends early, it cancels the scans still running
+    std::atomic<bool> stopping(false);
+    std::atomic<bool> *callerCancel = cancelFlag;
+    vector<std::thread> threads;
+    for (unsigned i = 0; i < scans.size(); ++i) {
+      AttributeScan *scan = scans[i].get();
+      string url = datomsUrl(basis, scan->ident);
+      std::atomic<bool> *stop = &stopping;
+      threads.push_back(std::thread([scan, url, stop]() {
+        cancelFlag = stop;
+        CURL *handle = curl_easy_init();
+        edn::EdnNode result;
+        try {
+          result = streamRequest(url, *scan, handle);
+        } catch (const char* e) {
+          result = edn::read("\"" + escapeString(e) + "\"");
+        }
+        curl_easy_cleanup(handle);
+        scan->finish(result);
+      }));
+    }
+
+    edn::EdnNode failure = edn::read("nil");
+
+    //heads[i] is the next unconsumed datom of scan i. a scan that ends is
+    //only taken as exhausted once its thread says it did not fail, so an
+    //entity is never written with an attribute missing because of an error
+    vector<edn::EdnNode> heads(scans.size());
+    vector<long long> ids(scans.size());
+    vector<bool> live(scans.size());
+    auto advance = [&](unsigned i) {
+      edn::EdnNode datom;
+      live[i] = false;
+      while (scans[i]->next(datom))
+        if ((live[i] = datomParts(datom, ids[i], heads[i]))) return true;
+      if (scans[i]->failed() && failure.type == edn::EdnNil) failure = scans[i]->result;
+      return false;
+    };
+
+    for (unsigned i = 0; i < scans.size(); ++i) advance(i);
+
+    while (failure.type == edn::EdnNil) {
+      if (callerCancel && *callerCancel) {
+        failure = edn::read("\"request cancelled\"");
+        break;
+      }
+
+      long long e = 0;
+      bool any = false;
+      for (unsigned i = 0; i < scans.size(); ++i)
+        if (live[i] && (!any || ids[i] < e)) {
+          e = ids[i];
+          any = true;
+        }
+      if (!any) break;
+
+      std::ostringstream id;
+      id << e;
+      edn::EdnNode row;
+      row.type = edn::EdnVector;
+      row.values.push_back(edn::read(id.str()));
+
+      for (unsigned i = 0; i < scans.size(); ++i) {
+        edn::EdnNode cell;
+        cell.type = scans[i]->many ? edn::EdnSet : edn::EdnNil;
+        if (!scans[i]->many) cell.value = "nil";
+        while (live[i] && ids[i] == e) {
+          if (scans[i]->many) cell.values.push_back(std::move(heads[i]));
+          else cell = std::move(heads[i]);
+          advance(i);
+        }
+        if (scans[i]->many && !cell.values.size()) {
+          cell.type = edn::EdnNil;
+          cell.value = "nil";
+        }
+        row.values.push_back(std::move(cell));
+      }
+      if (failure.type != edn::EdnNil) break;
+      sink.row(row);
+    }
+
+    stopping = true;
+    for (unsigned i = 0; i < scans.size(); ++i) scans[i]->stop();
+    for (unsigned i = 0; i < threads.size(); ++i) threads[i].join();
+    sink.done();
+    return failure;
+  }
+
+  class RowCollector : public RowSink {
+   public:
+    edn::EdnNode rows;
+
+    RowCollector() {
+      rows.type = edn::EdnVector;
+    }
+
+    void row(edn::EdnNode &row) {
+      rows.values.push_back(std::move(row));
+    }
+  };
+
+  edn::EdnNode listEntities(string ns) {
+    RowCollector collector;
+    edn::EdnNode result = streamEntities(ns, collector);
+    if (result.type != edn::EdnNil) return result;
+    return collector.rows;
+  }
+}
@@ -0,0 +1,200 @@
+#include <zlib.h>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <fstream>
+
+namespace datomicRest {
+
+  size_t exportBlockBytes = 1024 * 1024;
+
+  struct ExportBlock {
+    size_t firstRow;
+    size_t rows;
+    string raw;
+    string compressed;
+    bool compressedOk;
+    bool finished;
+
+    ExportBlock() : firstRow(0), rows(0), compressedOk(false), finished(false) {}
+  };
+
+  //one complete gzip member, so the blocks concatenated are still a file any
+  //gzip reader can stream while each one can also be inflated on its own
+  bool gzipBlock(const string &raw, string &out) {
+    z_stream zs;
+    zs.zalloc = Z_NULL;
+    zs.zfree = Z_NULL;
+    zs.opaque = Z_NULL;
+    if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK)
+      return false;
+    out.resize(deflateBound(&zs, raw.length()) + 32);
+    zs.next_in = (Bytef*)raw.data();
+    zs.avail_in = raw.length();
+    zs.next_out = (Bytef*)&out[0];
+    zs.avail_out = out.length();
+    int code = deflate(&zs, Z_FINISH);
+    out.resize(zs.total_out);
+    deflateEnd(&zs);
+    return code == Z_STREAM_END;
+  }
+
+  //writes rows as edn lines in blocks of about exportBlockBytes. full blocks
+  //are compressed on a pool of threads while the next one fills and written
+  //in order as they finish, so compression keeps up with the network. the
+  //rows are the text as received, never read and printed back. path.idx
+  //records where every block starts and which rows it holds. it is only
+  //written by finish once the request succeeded, otherwise both files go
+  class BlockExport : public RowSink {
+    string path;
+    std::ofstream out;
+    std::unique_ptr<ExportBlock> current;
+    std::deque<std::shared_ptr<ExportBlock> > pending;
+    std::deque<std::shared_ptr<ExportBlock> > queue;
+    size_t maxPending;
+    size_t rows;
+    unsigned long long offset;
+    bool stopping;
+    std::mutex lock;
+    std::condition_variable changed;
+    vector<std::thread> workers;
+    std::ostringstream index;
+    bool kept;
+
+   public:
+    string error;
+
+   private:
+    void run() {
+      std::unique_lock<std::mutex> guard(lock);
+      while (true) {
+        while (!stopping && !queue.size()) changed.wait(guard);
+        if (!queue.size()) break;
+        std::shared_ptr<ExportBlock> block = queue.front();
+        queue.pop_front();
+        guard.unlock();
+
+        block->compressedOk = gzipBlock(block->raw, block->compressed);
+        string().swap(block->raw);
+
+        guard.lock();
+        block->finished = true;
+        changed.notify_all();
+      }
+    }
+
+    //writes finished blocks from the front, waiting on it only while more
+    //than keep blocks are pending
+    void writeReady(size_t keep) {
+      std::unique_lock<std::mutex> guard(lock);
+      while (pending.size()) {
+        std::shared_ptr<ExportBlock> block = pending.front();
+        if (!block->finished) {
+          if (pending.size() <= keep) return;
+          changed.wait(guard);
+          continue;
+        }
+        pending.pop_front();
+        guard.unlock();
+
+        if (!block->compressedOk && !error.length()) error = "could not compress a block";
+        out.write(block->compressed.data(), block->compressed.length());
+        if (!out && !error.length()) error = "could not write " + path;
+        index << (offset ? " [" : "[") << offset << " " << block->compressed.length() << " "
+              << block->firstRow << " " << block->rows << "]";
+        offset += block->compressed.length();
+
+        guard.lock();
+      }
+    }
+
+    void submit() {
+      if (!current->rows) return;
+      std::shared_ptr<ExportBlock> block(current.release());
+      {
+        std::lock_guard<std::mutex> guard(lock);
+        pending.push_back(block);
+        queue.push_back(block);
+      }
+      changed.notify_all();
+      current.reset(new ExportBlock());
+      current->firstRow = rows;
+      writeReady(maxPending - 1);
+    }
+
+   public:
+    BlockExport(string file, int threads = 0)
+      : path(file), current(new ExportBlock()), rows(0), offset(0), stopping(false),
+        kept(false) {
+      std::remove((path + ".idx").c_str());
+      out.open(path.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+      if (!out) error = "could not open " + path;
+      if (threads < 1) threads = std::thread::hardware_concurrency();
+      if (threads < 1) threads = 2;
+      maxPending = threads * 2;
+      for (int i = 0; i < threads; ++i) workers.push_back(std::thread(&BlockExport::run, this));
+    }
+
+    ~BlockExport() {
+      {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+      }
+      changed.notify_all();
+      for (unsigned i = 0; i < workers.size(); ++i)
+        if (workers[i].joinable()) workers[i].join();
+      if (out.is_open()) out.close();
+      if (!kept) std::remove(path.c_str());
+    }
+
+    bool wantsText() { return true; }
+
+    void text(string &row) {
+      std::replace(row.begin(), row.end(), '\n', ' ');
+      std::replace(row.begin(), row.end(), '\r', ' ');
+      current->raw += row;
+      current->raw += '\n';
+      current->rows++;
+      rows++;
+      if (current->raw.length() >= exportBlockBytes) submit();
+    }
+
+    void row(edn::EdnNode &row) {
+      string line = edn::pprint(row);
+      text(line);
+    }
+
+    void done() {
+      submit();
+      writeReady(0);
+      out.close();
+    }
+
+    //result is the request's, nil when it succeeded. returns it or the
+    //export's own problem, or a summary once the index is written
+    edn::EdnNode finish(edn::EdnNode result) {
+      if (result.type == edn::EdnNil && error.length())
+        result = edn::read("\"Problem: " + escapeString(error) + "\"");
+      if (result.type != edn::EdnNil) return result;
+
+      std::ofstream idx((path + ".idx").c_str(), std::ios::out | std::ios::trunc);
+      idx << "{:format \"edn-lines\" :compression \"gzip-members\" :rows " << rows
+          << "\n :blocks [" << index.str() << "]}\n";
+      idx.close();
+      if (!idx) {
+        std::remove((path + ".idx").c_str());
+        return edn::read("\"Problem: could not write " + escapeString(path) + ".idx\"");
+      }
+      kept = true;
+
+      std::ostringstream summary;
+      summary << "{:out \"" << escapeString(path) << "\" :rows " << rows
+              << " :bytes " << offset << " :index \"" << escapeString(path) << ".idx\"}";
+      return edn::read(summary.str());
+    }
+  };
+}
@@ -0,0 +1,344 @@
+#include <deque>
+#include <unordered_set>
+#include <unordered_map>
+
+namespace datomicRest {
+
+  //one column of a stored result: a type tag per row plus the text of every
+  //cell and, for numeric cells, the parsed value so sorts and filters scan
+  //flat arrays instead of walking EdnNode lists
+  struct Column {
+    vector<edn::NodeType> types;
+    vector<string> text;
+    vector<double> numbers;
+
+    bool numeric(size_t row) const {
+      return types[row] == edn::EdnInt || types[row] == edn::EdnFloat;
+    }
+
+    size_t bytes() const {
+      size_t total = types.capacity() * sizeof(edn::NodeType) +
+                     numbers.capacity() * sizeof(double) +
+                     text.capacity() * sizeof(string);
+      for (size_t i = 0; i < text.size(); ++i) total += text[i].capacity();
+      return total;
+    }
+  };
+
+  bool isCollection(edn::NodeType type) {
+    return type == edn::EdnList || type == edn::EdnVector || type == edn::EdnMap ||
+           type == edn::EdnSet || type == edn::EdnTagged;
+  }
+
+  string cellText(edn::EdnNode &node) {
+    if (!isCollection(node.type)) return node.value;
+    string text = edn::pprint(node);
+    text.erase(std::remove(text.begin(), text.end(), '\n'), text.end());
+    return text;
+  }
+
+  struct StoredResult {
+    int id;
+    size_t rows;
+    vector<Column> columns;
+    edn::EdnNode header;
+
+    StoredResult() : id(0), rows(0) {}
+
+    void addCell(size_t column, edn::EdnNode &node) {
+      while (columns.size() <= column) {
+        columns.push_back(Column());
+        columns.back().types.resize(rows, edn::EdnNil);
+        columns.back().text.resize(rows, "nil");
+        columns.back().numbers.resize(rows, 0);
+      }
+      Column &col = columns[column];
+      col.types.push_back(node.type);
+      col.text.push_back(cellText(node));
+      col.numbers.push_back(col.numeric(col.types.size() - 1) ?
+                            strtod(node.value.c_str(), NULL) : 0);
+    }
+
+    //pads short rows with nil so every column stays rows long
+    void endRow() {
+      rows++;
+      for (size_t c = 0; c < columns.size(); ++c) {
+        Column &col = columns[c];
+        while (col.types.size() < rows) {
+          col.types.push_back(edn::EdnNil);
+          col.text.push_back("nil");
+          col.numbers.push_back(0);
+        }
+      }
+    }
+
+    size_t bytes() const {
+      size_t total = sizeof(StoredResult);
+      for (size_t c = 0; c < columns.size(); ++c) total += columns[c].bytes();
+      return total;
+    }
+
+    edn::EdnNode cell(size_t column, size_t row) const {
+      const Column &col = columns[column];
+      if (isCollection(col.types[row])) return edn::read(col.text[row]);
+      edn::EdnNode node;
+      node.type = col.types[row];
+      node.value = col.text[row];
+      return node;
+    }
+
+    edn::EdnNode toEdn() const {
+      edn::EdnNode result;
+      result.type = edn::EdnVector;
+      for (size_t r = 0; r < rows; ++r) {
+        edn::EdnNode row;
+        row.type = edn::EdnVector;
+        for (size_t c = 0; c < columns.size(); ++c) row.values.push_back(cell(c, r));
+        result.values.push_back(row);
+      }
+      return result;
+    }
+
+    //copies the given rows, in order, into a new result with the same header
+    StoredResult select(const vector<size_t> &picked) const {
+      StoredResult out;
+      out.header = header;
+      out.rows = picked.size();
+      out.columns.resize(columns.size());
+      for (size_t c = 0; c < columns.size(); ++c) {
+        const Column &from = columns[c];
+        Column &to = out.columns[c];
+        to.types.reserve(picked.size());
+        to.text.reserve(picked.size());
+        to.numbers.reserve(picked.size());
+        for (size_t i = 0; i < picked.size(); ++i) {
+          to.types.push_back(from.types[picked[i]]);
+          to.text.push_back(from.text[picked[i]]);
+          to.numbers.push_back(from.numbers[picked[i]]);
+        }
+      }
+      return out;
+    }
+
+    string columnName(size_t column) const {
+      std::list<edn::EdnNode>::const_iterator it = header.values.begin();
+      for (size_t i = 0; it != header.values.end(); ++it, ++i)
+        if (i == column) return it->value;
+      return "value";
+    }
+
+    //a column is addressed by index or by its header e.g. ?name
+    size_t columnIndex(edn::EdnNode &ref) const {
+      if (ref.type == edn::EdnInt) {
+        size_t index = atoi(ref.value.c_str());
+        if (index < columns.size()) return index;
+        throw "column index out of range";
+      }
+      size_t index = 0;
+      std::list<edn::EdnNode>::const_iterator it;
+      for (it = header.values.begin(); it != header.values.end(); ++it, ++index)
+        if (it->value == ref.value && index < columns.size()) return index;
+      throw "no such column";
+    }
+  };
+
+  //vectors of rows become columns directly, vectors of scalars become one
+  //column and maps become key/value rows, matching how TBL prints them
+  StoredResult toColumns(edn::EdnNode &result, edn::EdnNode &header) {
+    StoredResult stored;
+    stored.header = header;
+    std::list<edn::EdnNode>::iterator it;
+    if (result.type == edn::EdnMap) {
+      stored.header = edn::read("[\"key\" \"value\"]");
+      for (it = result.values.begin(); it != result.values.end(); ++it) {
+        stored.addCell(0, *it);
+        if (++it == result.values.end()) break;
+        stored.addCell(1, *it);
+        stored.endRow();
+      }
+    } else if (result.type == edn::EdnVector || result.type == edn::EdnList ||
+               result.type == edn::EdnSet) {
+      for (it = result.values.begin(); it != result.values.end(); ++it) {
+        if (it->type == edn::EdnVector || it->type == edn::EdnList) {
+          size_t column = 0;
+          std::list<edn::EdnNode>::iterator cit;
+          for (cit = it->values.begin(); cit != it->values.end(); ++cit)
+            stored.addCell(column++, *cit);
+        } else {
+          stored.addCell(0, *it);
+        }
+        stored.endRow();
+      }
+    } else {
+      stored.addCell(0, result);
+      stored.endRow();
+    }
+    return stored;
+  }
+
+  //numbers order before everything else, then by text
+  int compareCells(const Column &col, size_t a, size_t b) {
+    bool an = col.numeric(a);
+    bool bn = col.numeric(b);
+    if (an && bn) {
+      if (col.numbers[a] < col.numbers[b]) return -1;
+      return col.numbers[a] > col.numbers[b] ? 1 : 0;
+    }
+    if (an != bn) return an ? -1 : 1;
+    return col.text[a].compare(col.text[b]);
+  }
+
+  //keeps the last maxResults results within budget bytes, oldest evicted
+  //first. ids keep counting up so $n always means the same result
+  class ResultHistory {
+    std::deque<StoredResult> results;
+    size_t used;
+    int nextId;
+
+   public:
+    size_t maxResults;
+    size_t budget;
+
+    ResultHistory(size_t max = 20, size_t bytes = 256 * 1024 * 1024)
+      : used(0), nextId(1), maxResults(max), budget(bytes) {}
+
+    StoredResult &add(StoredResult stored) {
+      stored.id = nextId++;
+      used += stored.bytes();
+      results.push_back(std::move(stored));
+      while (results.size() > 1 &&
+             (results.size() > maxResults || used > budget)) {
+        used -= results.front().bytes();
+        results.pop_front();
+      }
+      return results.back();
+    }
+
+    StoredResult &add(edn::EdnNode &result, edn::EdnNode &header) {
+      return add(toColumns(result, header));
+    }
+
+    //accepts $n or $ for the most recent result
+    StoredResult &get(string ref) {
+      if (!results.size()) throw "no results in history";
+      if (ref == "$") return results.back();
+      int id = atoi(ref.substr(1).c_str());
+      for (size_t i = 0; i < results.size(); ++i)
+        if (results[i].id == id) return results[i];
+      throw "no such result in history";
+    }
+
+    static bool isRef(edn::EdnNode &node) {
+      return node.type == edn::EdnSymbol && node.value.length() &&
+             node.value[0] == '$' &&
+             (node.value.length() == 1 || edn::validInt(node.value.substr(1), false));
+    }
+
+    edn::EdnNode list() {
+      std::ostringstream out;
+      for (size_t i = 0; i < results.size(); ++i) {
+        out << "[$" << results[i].id << " " << results[i].rows << " "
+            << results[i].columns.size() << " " << results[i].bytes() << "]";
+      }
+      return edn::read("[" + out.str() + "]");
+    }
+  };
+
+  StoredResult sortResult(const StoredResult &from, edn::EdnNode &columnRef, bool descending) {
+    size_t c = from.columnIndex(columnRef);
+    const Column &col = from.columns[c];
+    vector<size_t> order(from.rows);
+    for (size_t i = 0; i < order.size(); ++i) order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&col, descending](size_t a, size_t b) {
+      int cmp = compareCells(col, a, b);
+      return descending ? cmp > 0 : cmp < 0;
+    });
+    return from.select(order);
+  }
+
+  StoredResult whereResult(const StoredResult &from, edn::EdnNode &columnRef,
+                           string op, edn::EdnNode &value) {
+    size_t c = from.columnIndex(columnRef);
+    const Column &col = from.columns[c];
+    bool numeric = value.type == edn::EdnInt || value.type == edn::EdnFloat;
+    double number = numeric ? strtod(value.value.c_str(), NULL) : 0;
+    string text = cellText(value);
+
+    if (op != "=" && op != "!=" && op != "<" && op != ">" && op != "<=" && op != ">=")
+      throw "where expects one of = != < > <= >=";
+
+    vector<size_t> picked;
+    for (size_t r = 0; r < from.rows; ++r) {
+      int cmp;
+      if (numeric && col.numeric(r))
+        cmp = col.numbers[r] < number ? -1 : (col.numbers[r] > number ? 1 : 0);
+      else
+        cmp = col.text[r].compare(text);
+
+      bool keep = (op == "=" && cmp == 0) || (op == "!=" && cmp != 0) ||
+                  (op == "<" && cmp < 0)  || (op == ">" && cmp > 0)   ||
+                  (op == "<=" && cmp <= 0) || (op == ">=" && cmp >= 0);
+      if (keep) picked.push_back(r);
+    }
+    return from.select(picked);
+  }
+
+  string rowKey(const StoredResult &from, size_t r) {
+    string key;
+    for (size_t c = 0; c < from.columns.size(); ++c) {
+      key += char('0' + from.columns[c].types[r]);
+      key += from.columns[c].text[r];
+      key += '\x1f';
+    }
+    return key;
+  }
+
+  StoredResult distinctResult(const StoredResult &from) {
+    std::unordered_set<string> seen;
+    vector<size_t> picked;
+    for (size_t r = 0; r < from.rows; ++r)
+      if (seen.insert(rowKey(from, r)).second) picked.push_back(r);
+    return from.select(picked);
+  }
+
+  //one row per distinct value of the column with its count, largest first
+  StoredResult groupByResult(const StoredResult &from, edn::EdnNode &columnRef) {
+    size_t c = from.columnIndex(columnRef);
+    const Column &col = from.columns[c];
+    std::unordered_map<string, size_t> slots;
+    vector<size_t> firstRow;
+    vector<long> counts;
+    for (size_t r = 0; r < from.rows; ++r) {
+      string key = char('0' + col.types[r]) + col.text[r];
+      std::unordered_map<string, size_t>::iterator it = slots.find(key);
+      if (it == slots.end()) {
+        slots[key] = counts.size();
+        firstRow.push_back(r);
+        counts.push_back(1);
+      } else {
+        counts[it->second]++;
+      }
+    }
+
+    vector<size_t> order(counts.size());
+    for (size_t i = 0; i < order.size(); ++i) order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&counts](size_t a, size_t b) {
+      return counts[a] > counts[b];
+    });
+
+    StoredResult out;
+    out.header = edn::read("[\"" + escapeString(from.columnName(c)) + "\" \"count\"]");
+    for (size_t i = 0; i < order.size(); ++i) {
+      edn::EdnNode value = from.cell(c, firstRow[order[i]]);
+      std::ostringstream count;
+      count << counts[order[i]];
+      edn::EdnNode total;
+      total.type = edn::EdnInt;
+      total.value = count.str();
+      out.addCell(0, value);
+      out.addCell(1, total);
+      out.endRow();
+    }
+    return out;
+  }
+}
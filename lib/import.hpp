@@ -0,0 +1,381 @@
+#include <fstream>
+#include <unordered_map>
+
+namespace datomicRest {
+
+  //reads one record, quoted fields may hold separators, "" and newlines
+  bool readCsvRecord(std::istream &in, char sep, vector<string> &fields) {
+    fields.clear();
+    string field;
+    bool quoted = false;
+    bool any = false;
+    int c;
+    while ((c = in.get()) != EOF) {
+      any = true;
+      if (quoted) {
+        if (c == '"') {
+          if (in.peek() == '"') {
+            field += '"';
+            in.get();
+          } else {
+            quoted = false;
+          }
+        } else {
+          field += char(c);
+        }
+      } else if (c == '"') {
+        quoted = true;
+      } else if (c == sep) {
+        fields.push_back(field);
+        field.clear();
+      } else if (c == '\n') {
+        break;
+      } else if (c != '\r') {
+        field += char(c);
+      }
+    }
+    if (!any) return false;
+    fields.push_back(field);
+    return true;
+  }
+
+  struct ImportColumn {
+    string ident;
+    string valueType;
+    bool many;
+  };
+
+  //entity ids of import keys across batches. a key is pending while the
+  //batch that creates it is in flight, then resolved or failed with it
+  class ImportKeys {
+    struct Tempid {
+      long long eid; //0 while its batch is in flight, -1 if it failed
+      long batch;
+    };
+    std::unordered_map<string, Tempid> keys;
+    std::mutex lock;
+
+    void add(const vector<string> &names, long long eid, long batch) {
+      for (unsigned i = 0; i < names.size(); ++i) {
+        if (!names[i].length() || keys.count(names[i])) continue;
+        Tempid tempid = { eid, batch };
+        keys[names[i]] = tempid;
+      }
+    }
+
+   public:
+    enum State { UNKNOWN, PENDING, RESOLVED, FAILED };
+
+    //eid when resolved, the batch to wait for when pending
+    State find(const string &key, long long &eid, long &batch) {
+      std::lock_guard<std::mutex> guard(lock);
+      std::unordered_map<string, Tempid>::iterator it = keys.find(key);
+      if (it == keys.end()) return UNKNOWN;
+      eid = it->second.eid;
+      batch = it->second.batch;
+      if (eid == 0) return PENDING;
+      return eid < 0 ? FAILED : RESOLVED;
+    }
+
+    //names[n - 1] is written as #db/id [:db.part/user -n] in batch
+    void pending(const vector<string> &names, long batch) {
+      std::lock_guard<std::mutex> guard(lock);
+      add(names, 0, batch);
+    }
+
+    void failed(const vector<string> &names) {
+      std::lock_guard<std::mutex> guard(lock);
+      add(names, -1, 0);
+    }
+
+    //ids is the batch's :tempids by index, a key missing from it failed
+    void completed(const vector<string> &names, long batch, std::map<long long, long long> &ids) {
+      std::lock_guard<std::mutex> guard(lock);
+      for (unsigned i = 0; i < names.size(); ++i) {
+        if (!names[i].length()) continue;
+        Tempid tempid = { -1, batch };
+        std::map<long long, long long>::iterator it = ids.find(-(long long)(i + 1));
+        if (it != ids.end()) tempid.eid = it->second;
+        keys[names[i]] = tempid;
+      }
+    }
+  };
+
+  //maps file columns onto a namespace's attributes and transacts the rows in
+  //batches through a TxPool. a :db/id column names entities; the same key,
+  //or @key in a ref column, resolves to the same entity in every batch as
+  //long as the row naming it is in the same or an earlier batch
+  class CsvImporter : public TxHandler {
+    vector<ImportColumn> columns;
+    int idColumn;
+    size_t batchSize;
+
+    ImportKeys keys;
+
+    TxBatch current;
+    std::unordered_map<string, int> currentLocals;
+    vector<size_t> currentRows;
+
+    size_t imported;
+    size_t skipped;
+    long batches;
+    vector<string> errors;
+    vector<string> failed;
+    std::mutex resultsLock;
+    TxPool *pool;
+
+    void error(string message) {
+      if (errors.size() < 100) errors.push_back(message);
+    }
+
+    string localId(int n) {
+      std::ostringstream id;
+      id << "#db/id [:db.part/user -" << n << "]";
+      return id.str();
+    }
+
+    //entity id, tempid in this batch, or false if the key's batch failed
+    bool resolveKey(string key, string &out) {
+      std::unordered_map<string, int>::iterator lit = currentLocals.find(key);
+      if (lit != currentLocals.end()) {
+        out = localId(lit->second);
+        return true;
+      }
+
+      long long eid = 0;
+      long batch = 0;
+      switch (keys.find(key, eid, batch)) {
+        case ImportKeys::PENDING:
+          pool->waitFor(batch);
+          return resolveKey(key, out);
+        case ImportKeys::FAILED:
+          return false;
+        case ImportKeys::RESOLVED: {
+          std::ostringstream id;
+          id << eid;
+          out = id.str();
+          return true;
+        }
+        case ImportKeys::UNKNOWN:
+          break;
+      }
+
+      current.tempidKeys.push_back(key);
+      currentLocals[key] = current.tempidKeys.size();
+      out = localId(current.tempidKeys.size());
+      return true;
+    }
+
+    //a batch that fails validation never goes out, its keys fail with it
+    void reject(vector<TxError> &invalid) {
+      for (unsigned i = 0; i < invalid.size(); ++i) {
+        std::ostringstream message;
+        size_t form = invalid[i].form;
+        message << "row " << (form < currentRows.size() ? currentRows[form] : current.firstRow)
+                << ": " << invalid[i].attribute << " " << invalid[i].message;
+        error(message.str());
+      }
+
+      keys.failed(current.tempidKeys);
+
+      std::lock_guard<std::mutex> guard(resultsLock);
+      skipped += current.rows;
+      std::ostringstream entry;
+      entry << "[" << current.firstRow << " " << currentRows.back()
+            << " \"invalid, see :errors\"]";
+      failed.push_back(entry.str());
+    }
+
+    void flush() {
+      if (!current.rows) return;
+      current.txData = "[" + current.txData + "]";
+
+      if (validate) {
+        edn::EdnNode tx = edn::read(current.txData);
+        TxValidator validator;
+        validator.check(tx);
+        if (validator.errors.size()) {
+          reject(validator.errors);
+          current = TxBatch();
+          currentLocals.clear();
+          currentRows.clear();
+          return;
+        }
+      }
+
+      vector<string> pending(current.tempidKeys);
+
+      long number = pool->submit(current);
+      batches++;
+      keys.pending(pending, number);
+
+      current = TxBatch();
+      currentLocals.clear();
+      currentRows.clear();
+    }
+
+   public:
+    CsvImporter(size_t size) : idColumn(-1), batchSize(size < 1 ? 1 : size),
+                               imported(0), skipped(0), batches(0), pool(NULL) {}
+
+    void completed(TxBatch &batch) {
+      bool ok = batch.responseCode == 200 || batch.responseCode == 201;
+      std::map<long long, long long> ids;
+      if (ok) {
+        try {
+          ids = resultTempids(batch.body);
+        } catch (const char* e) {
+          ok = false;
+        }
+      }
+
+      keys.completed(batch.tempidKeys, batch.number, ids);
+
+      std::lock_guard<std::mutex> guard(resultsLock);
+      if (ok) {
+        imported += batch.rows;
+      } else {
+        std::ostringstream entry;
+        entry << "[" << batch.firstRow << " " << batch.firstRow + batch.rows - 1 << " \""
+              << escapeString(problem(batch.body).value) << "\"]";
+        failed.push_back(entry.str());
+      }
+    }
+
+    //header names are attr, :ns/attr or ns/attr; db/id marks the key column
+    void mapHeader(vector<string> &header, string ns, edn::EdnNode &attributes) {
+      std::map<string, ImportColumn> byIdent;
+      std::list<edn::EdnNode>::iterator it;
+      for (it = attributes.values.begin(); it != attributes.values.end(); ++it) {
+        vector<edn::EdnNode> attr(it->values.begin(), it->values.end());
+        if (attr.size() < 3) continue;
+        ImportColumn column = { attr[0].value, attr[1].value,
+                                attr[2].value == ":db.cardinality/many" };
+        byIdent[attr[0].value] = column;
+      }
+
+      for (unsigned i = 0; i < header.size(); ++i) {
+        string name = trim(header[i]);
+        if (name == "db/id" || name == ":db/id") {
+          idColumn = i;
+          columns.push_back(ImportColumn());
+          continue;
+        }
+        if (name.find('/') == string::npos) name = getJustNamespace(ns) + "/" + name;
+        if (name[0] != ':') name = ":" + name;
+        if (!byIdent.count(name)) throw "column does not match an attribute of the namespace";
+        columns.push_back(byIdent[name]);
+      }
+    }
+
+    void addRow(vector<string> &fields, size_t rowNumber) {
+      string entity;
+      string attrs;
+      bool ok = true;
+
+      //refs and ids may add tempids to the batch, roll them back on a bad row
+      size_t tempidMark = current.tempidKeys.size();
+
+      if (idColumn >= 0 && idColumn < int(fields.size()) && fields[idColumn].length()) {
+        if (!resolveKey(fields[idColumn], entity)) {
+          std::ostringstream message;
+          message << "row " << rowNumber << ": entity " << fields[idColumn]
+                  << " was in a failed batch";
+          error(message.str());
+          ok = false;
+        }
+      } else {
+        current.tempidKeys.push_back("");
+        entity = localId(current.tempidKeys.size());
+      }
+
+      for (unsigned i = 0; ok && i < fields.size() && i < columns.size(); ++i) {
+        if (int(i) == idColumn || !fields[i].length()) continue;
+        ImportColumn &column = columns[i];
+
+        vector<string> values;
+        if (column.many) {
+          std::stringstream parts(fields[i]);
+          string part;
+          while (std::getline(parts, part, '|')) values.push_back(part);
+        } else {
+          values.push_back(fields[i]);
+        }
+
+        string coerced;
+        for (unsigned v = 0; v < values.size(); ++v) {
+          string edn;
+          bool valid;
+          if (column.valueType == ":db.type/ref" && values[v][0] == '@')
+            valid = resolveKey(values[v].substr(1), edn);
+          else
+            valid = coerceValue(values[v], column.valueType, edn);
+
+          if (!valid) {
+            std::ostringstream message;
+            message << "row " << rowNumber << " column " << i + 1 << ": can not read \""
+                    << values[v] << "\" as " << column.valueType;
+            error(message.str());
+            ok = false;
+            break;
+          }
+          coerced += (v ? " " : "") + edn;
+        }
+        attrs += " " + column.ident + " " + (column.many ? "[" + coerced + "]" : coerced);
+      }
+
+      if (!ok) {
+        skipped++;
+        while (current.tempidKeys.size() > tempidMark) {
+          currentLocals.erase(current.tempidKeys.back());
+          current.tempidKeys.pop_back();
+        }
+        return;
+      }
+
+      if (!current.rows) current.firstRow = rowNumber;
+      current.rows++;
+      currentRows.push_back(rowNumber);
+      current.txData += "{:db/id " + entity + attrs + "}";
+      if (current.rows >= batchSize) flush();
+    }
+
+    edn::EdnNode run(std::istream &in, char sep, string ns, int inFlight) {
+      edn::EdnNode attributes = getAttributes(ns);
+      if (attributes.type == edn::EdnString) return attributes;
+
+      vector<string> fields;
+      if (!readCsvRecord(in, sep, fields)) throw "import file is empty";
+      mapHeader(fields, ns, attributes);
+
+      TxPool txPool(inFlight, this);
+      pool = &txPool;
+      size_t rowNumber = 1;
+      while (readCsvRecord(in, sep, fields)) {
+        rowNumber++;
+        if (fields.size() == 1 && !fields[0].length()) continue;
+        addRow(fields, rowNumber);
+      }
+      flush();
+      txPool.drain();
+      pool = NULL;
+
+      std::ostringstream out;
+      out << "{:rows " << rowNumber - 1 << " :imported " << imported
+          << " :skipped " << skipped << " :batches " << batches << " :failed-batches [";
+      for (unsigned i = 0; i < failed.size(); ++i) out << failed[i];
+      out << "] :errors [";
+      for (unsigned i = 0; i < errors.size(); ++i) out << "\"" << escapeString(errors[i]) << "\"";
+      out << "]}";
+      return edn::read(out.str());
+    }
+  };
+
+  edn::EdnNode importFile(string path, string ns, size_t batchSize, int inFlight) {
+    std::ifstream in(path.c_str(), std::ios::in | std::ios::binary);
+    if (!in) throw "could not open import file";
+    char sep = path.length() > 4 && path.substr(path.length() - 4) == ".tsv" ? '\t' : ',';
+    CsvImporter importer(batchSize);
+    return importer.run(in, sep, ns, inFlight);
+  }
+}
@@ -0,0 +1,123 @@
+#include <functional>
+#include <memory>
+#include <thread>
+#include <chrono>
+
+namespace datomicRest {
+
+  //a command running on its own thread and curl handle. cancel is checked by
+  //the curl progress callback so kill aborts the request mid transfer
+  struct Job {
+    int id;
+    string command;
+    std::atomic<bool> cancel;
+    std::atomic<bool> finished;
+    edn::EdnNode result;
+    edn::EdnNode header;
+    string error;
+    std::thread thread;
+
+    Job() : id(0), cancel(false), finished(false) {}
+  };
+
+  class JobTable {
+    std::list<std::unique_ptr<Job> > jobs;
+    int nextId;
+
+   public:
+    JobTable() : nextId(1) {}
+
+    ~JobTable() {
+      std::list<std::unique_ptr<Job> >::iterator it;
+      for (it = jobs.begin(); it != jobs.end(); ++it) {
+        (*it)->cancel = true;
+        if ((*it)->thread.joinable()) (*it)->thread.join();
+      }
+    }
+
+    //work fills result and returns false when it did not understand the command
+    Job &start(string command, std::function<bool(edn::EdnNode&)> work) {
+      std::unique_ptr<Job> job(new Job());
+      job->id = nextId++;
+      job->command = command;
+      Job *running = job.get();
+      running->thread = std::thread([running, work]() {
+        curl = curl_easy_init();
+        cancelFlag = &running->cancel;
+        try {
+          if (!work(running->result)) running->error = "can not run that in the background";
+          running->header = queryHeader;
+        } catch (const char* e) {
+          running->error = e;
+        } catch (string e) {
+          running->error = e;
+        }
+        curl_easy_cleanup(curl);
+        running->finished = true;
+      });
+      jobs.push_back(std::move(job));
+      return *running;
+    }
+
+    //joins and hands over every job that has finished
+    vector<std::unique_ptr<Job> > collect() {
+      vector<std::unique_ptr<Job> > done;
+      std::list<std::unique_ptr<Job> >::iterator it = jobs.begin();
+      while (it != jobs.end()) {
+        if ((*it)->finished) {
+          (*it)->thread.join();
+          done.push_back(std::move(*it));
+          it = jobs.erase(it);
+        } else {
+          ++it;
+        }
+      }
+      return done;
+    }
+
+    bool hasFinished() {
+      std::list<std::unique_ptr<Job> >::iterator it;
+      for (it = jobs.begin(); it != jobs.end(); ++it)
+        if ((*it)->finished) return true;
+      return false;
+    }
+
+    Job *find(int id) {
+      std::list<std::unique_ptr<Job> >::iterator it;
+      for (it = jobs.begin(); it != jobs.end(); ++it)
+        if ((*it)->id == id) return it->get();
+      return NULL;
+    }
+
+    bool kill(int id) {
+      Job *job = find(id);
+      if (!job) return false;
+      job->cancel = true;
+      return true;
+    }
+
+    //blocks until the job (or every job for id 0) finishes or interrupted is set
+    void wait(int id, std::atomic<bool> &interrupted) {
+      while (!interrupted) {
+        bool pending = false;
+        std::list<std::unique_ptr<Job> >::iterator it;
+        for (it = jobs.begin(); it != jobs.end(); ++it)
+          if ((id == 0 || (*it)->id == id) && !(*it)->finished) pending = true;
+        if (!pending) return;
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+      }
+    }
+
+    edn::EdnNode list() {
+      string rows;
+      std::list<std::unique_ptr<Job> >::iterator it;
+      for (it = jobs.begin(); it != jobs.end(); ++it) {
+        std::ostringstream row;
+        row << "[" << (*it)->id << " \"" << escapeString((*it)->command) << "\" "
+            << ((*it)->finished ? ":done" : (*it)->cancel ? ":killing" : ":running") << "]";
+        rows += row.str();
+      }
+      return edn::read("[" + rows + "]");
+    }
+  };
+}
@@ -0,0 +1,124 @@
+#include <set>
+
+namespace datomicRest {
+
+  //a clause prefix is flagged when its row count grows by more than this
+  //factor over the largest intermediate result seen before it
+  double profileExplosionFactor = 10.0;
+  long profileExplosionMin = 1000;
+
+  void collectVars(edn::EdnNode &node, vector<string> &vars, std::set<string> &seen) {
+    if (node.type == edn::EdnSymbol && node.value.length() > 1 &&
+        node.value[0] == '?' && !seen.count(node.value)) {
+      seen.insert(node.value);
+      vars.push_back(node.value);
+    }
+    std::list<edn::EdnNode>::iterator it;
+    for (it = node.values.begin(); it != node.values.end(); ++it)
+      collectVars(*it, vars, seen);
+  }
+
+  //vars a where clause binds for the clauses after it. not and not-join
+  //bind nothing, or-join binds its join vars and or the vars every branch
+  //shares, so the first branch's
+  void clauseVars(edn::EdnNode &clause, vector<string> &vars, std::set<string> &seen) {
+    if (clause.type != edn::EdnList || !clause.values.size()) {
+      collectVars(clause, vars, seen);
+      return;
+    }
+    std::list<edn::EdnNode>::iterator it = clause.values.begin();
+    if (it->type == edn::EdnSymbol && it->value[0] == '$' && clause.values.size() > 1) ++it;
+    string head = it->type == edn::EdnSymbol ? it->value : "";
+    std::list<edn::EdnNode>::iterator rest = it;
+    ++rest;
+
+    if (head == "not" || head == "not-join") return;
+    if (head == "or-join" || head == "or") {
+      if (rest == clause.values.end()) return;
+      if (head == "or-join") collectVars(*rest, vars, seen);
+      else clauseVars(*rest, vars, seen);
+      return;
+    }
+    if (head == "and") {
+      for (; rest != clause.values.end(); ++rest) clauseVars(*rest, vars, seen);
+      return;
+    }
+    collectVars(clause, vars, seen);
+  }
+
+  //runs every prefix of the :where clauses as a count over the variables
+  //bound so far, reporting time and intermediate cardinality per clause
+  edn::EdnNode profileQuery(string queryString, string extraArgs = "") {
+    edn::EdnNode qedn = edn::read(queryString);
+    if (qedn.type != edn::EdnVector) throw "profile expects a query vector";
+
+    string inClause;
+    vector<edn::EdnNode> whereClauses;
+    std::set<string> inVars;
+    string section;
+    std::list<edn::EdnNode>::iterator it;
+    for (it = qedn.values.begin(); it != qedn.values.end(); ++it) {
+      if (it->type == edn::EdnKeyword) {
+        section = it->value;
+        if (section == ":in") inClause = ":in";
+        continue;
+      }
+      if (section == ":in") {
+        inClause += " " + edn::pprint(*it);
+        vector<string> vars;
+        collectVars(*it, vars, inVars);
+      } else if (section == ":where") {
+        whereClauses.push_back(*it);
+      }
+    }
+
+    if (!whereClauses.size()) throw "profile expects a query with :where clauses";
+
+    string rows;
+    string where;
+    vector<string> bound;
+    std::set<string> seen(inVars);
+    long largest = 0;
+    for (unsigned i = 0; i < whereClauses.size(); ++i) {
+      where += " " + edn::pprint(whereClauses[i]);
+      clauseVars(whereClauses[i], bound, seen);
+
+      string clause = edn::pprint(whereClauses[i]);
+      clause.erase(std::remove(clause.begin(), clause.end(), '\n'), clause.end());
+
+      long count = 0;
+      double elapsed = 0;
+      if (bound.size()) {
+        string countQuery = "[:find (count " + bound[0] + ")";
+        if (bound.size() > 1) {
+          countQuery += " :with";
+          for (unsigned j = 1; j < bound.size(); ++j) countQuery += " " + bound[j];
+        }
+        countQuery += " " + inClause + " :where" + where + "]";
+
+        double start = nowMs();
+        edn::EdnNode result = query(countQuery, extraArgs);
+        elapsed = nowMs() - start;
+
+        if (result.type == edn::EdnString) return result;
+        if (atPathExists("[0 0]", result))
+          count = atol(atPath("[0 0]", result).value.c_str());
+      }
+
+      bool explodes = i > 0 && count >= profileExplosionMin &&
+                      count > largest * profileExplosionFactor;
+      if (count > largest) largest = count;
+
+      std::ostringstream row;
+      row << std::fixed << std::setprecision(2)
+          << "{:clause " << i + 1
+          << " :where \"" << escapeString(clause) << "\""
+          << " :ms " << elapsed
+          << " :rows " << count
+          << " :explodes " << (explodes ? "true" : "false") << "}";
+      rows += row.str();
+    }
+
+    return edn::read("[" + rows + "]");
+  }
+}
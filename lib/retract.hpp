@@ -0,0 +1,103 @@
+namespace datomicRest {
+
+  //turns a stream of entity ids into [:db.fn/retractEntity id] transactions of
+  //batchSize, at most inFlight at a time, so memory stays at one batch per
+  //worker however many entities are fed in. with dryRun it only counts
+  class RetractStream : public RowSink, public TxHandler {
+    size_t batchSize;
+    bool dryRun;
+    TxPool *pool;
+    TxBatch current;
+    size_t seen;
+    size_t ignored;
+    long batches;
+    size_t retracted;
+    vector<string> failed;
+    std::mutex resultsLock;
+
+    void flush() {
+      if (!current.rows) return;
+      current.txData = "[" + current.txData + "]";
+      pool->submit(current);
+      batches++;
+      current = TxBatch();
+    }
+
+   public:
+    RetractStream(size_t size, bool dry, int inFlight)
+      : batchSize(size < 1 ? 1 : size), dryRun(dry), pool(NULL), seen(0),
+        ignored(0), batches(0), retracted(0) {
+      if (!dryRun) pool = new TxPool(inFlight, this);
+    }
+
+    ~RetractStream() { delete pool; }
+
+    //ids are longs or idents, anything else is counted and skipped
+    void add(const string &id) {
+      if (!id.length()) return;
+      seen++;
+      if (!edn::validInt(id, false) && id[0] != ':') {
+        ignored++;
+        return;
+      }
+      if (dryRun) return;
+      if (!current.rows) current.firstRow = seen;
+      current.rows++;
+      current.txData += "[:db.fn/retractEntity " + id + "]";
+      if (current.rows >= batchSize) flush();
+    }
+
+    //query rows retract their first column
+    void row(edn::EdnNode &row) {
+      if ((row.type == edn::EdnVector || row.type == edn::EdnList) && row.values.size())
+        add(row.values.front().value);
+      else
+        add(row.value);
+    }
+
+    void completed(TxBatch &batch) {
+      std::lock_guard<std::mutex> guard(resultsLock);
+      if (batch.responseCode == 200 || batch.responseCode == 201) {
+        retracted += batch.rows;
+      } else {
+        std::ostringstream entry;
+        entry << "[" << batch.firstRow << " " << batch.firstRow + batch.rows - 1 << " \""
+              << escapeString(problem(batch.body).value) << "\"]";
+        failed.push_back(entry.str());
+      }
+    }
+
+    //reads whitespace or comma separated ids, brackets are ignored so an edn
+    //vector of ids works as well as one id per line
+    void read(std::istream &in) {
+      string id;
+      char c;
+      while (in.get(c)) {
+        if (isspace(c) || c == ',' || c == '[' || c == ']') {
+          add(id);
+          id.clear();
+        } else {
+          id += c;
+        }
+      }
+      add(id);
+    }
+
+    edn::EdnNode finish() {
+      std::ostringstream out;
+      if (dryRun) {
+        out << "{:dry-run true :entities " << seen - ignored << " :ignored " << ignored << "}";
+        return edn::read(out.str());
+      }
+
+      flush();
+      pool->drain();
+      out << "{:entities " << seen - ignored << " :ignored " << ignored
+          << " :retracted " << retracted << " :batches " << batches
+          << " :failed-batches [";
+      for (unsigned i = 0; i < failed.size(); ++i) out << failed[i];
+      out << "]}";
+      return edn::read(out.str());
+    }
+  };
+}
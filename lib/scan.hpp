@@ -0,0 +1,178 @@
+#include <stdint.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+namespace datomicRest {
+
+  //bit i of each mask is set when byte i of a 64 byte block is that class
+  struct BlockMasks {
+    uint64_t quote;
+    uint64_t backslash;
+    uint64_t newline;
+    uint64_t special;
+  };
+
+  typedef void (*ScanFn)(const char*, BlockMasks&);
+
+  //structural characters the row splitter has to look at, everything else
+  //is copied through in runs
+  inline bool isSpecial(char c) {
+    switch (c) {
+      case '"': case '\\': case ';':
+      case '[': case ']': case '(': case ')': case '{': case '}':
+      case ' ': case '\t': case '\n': case '\r': case ',':
+        return true;
+    }
+    return false;
+  }
+
+  void scanBlockScalar(const char *p, BlockMasks &m) {
+    m.quote = m.backslash = m.newline = m.special = 0;
+    for (int i = 0; i < 64; ++i) {
+      uint64_t bit = uint64_t(1) << i;
+      if (p[i] == '"') m.quote |= bit;
+      if (p[i] == '\\') m.backslash |= bit;
+      if (p[i] == '\n') m.newline |= bit;
+      if (isSpecial(p[i])) m.special |= bit;
+    }
+  }
+
+#if defined(__SSE2__)
+  void scanBlockSse2(const char *p, BlockMasks &m) {
+    m.quote = m.backslash = m.newline = m.special = 0;
+    for (int k = 0; k < 4; ++k) {
+      __m128i v = _mm_loadu_si128((const __m128i*)(p + 16 * k));
+      __m128i q = _mm_cmpeq_epi8(v, _mm_set1_epi8('"'));
+      __m128i bs = _mm_cmpeq_epi8(v, _mm_set1_epi8('\\'));
+      __m128i nl = _mm_cmpeq_epi8(v, _mm_set1_epi8('\n'));
+      __m128i sp = _mm_or_si128(_mm_or_si128(q, bs), nl);
+      sp = _mm_or_si128(sp, _mm_cmpeq_epi8(v, _mm_set1_epi8(';')));
+      sp = _mm_or_si128(sp, _mm_cmpeq_epi8(v, _mm_set1_epi8('[')));
+      sp = _mm_or_si128(sp, _mm_cmpeq_epi8(v, _mm_set1_epi8(']')));
+      sp = _mm_or_si128(sp, _mm_cmpeq_epi8(v, _mm_set1_epi8('(')));
+      sp = _mm_or_si128(sp, _mm_cmpeq_epi8(v, _mm_set1_epi8(')')));
+      sp = _mm_or_si128(sp, _mm_cmpeq_epi8(v, _mm_set1_epi8('{')));
+      sp = _mm_or_si128(sp, _mm_cmpeq_epi8(v, _mm_set1_epi8('}')));
+      sp = _mm_or_si128(sp, _mm_cmpeq_epi8(v, _mm_set1_epi8(' ')));
+      sp = _mm_or_si128(sp, _mm_cmpeq_epi8(v, _mm_set1_epi8('\t')));
+      sp = _mm_or_si128(sp, _mm_cmpeq_epi8(v, _mm_set1_epi8('\r')));
+      sp = _mm_or_si128(sp, _mm_cmpeq_epi8(v, _mm_set1_epi8(',')));
+      int shift = 16 * k;
+      m.quote |= uint64_t(_mm_movemask_epi8(q) & 0xffff) << shift;
+      m.backslash |= uint64_t(_mm_movemask_epi8(bs) & 0xffff) << shift;
+      m.newline |= uint64_t(_mm_movemask_epi8(nl) & 0xffff) << shift;
+      m.special |= uint64_t(_mm_movemask_epi8(sp) & 0xffff) << shift;
+    }
+  }
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+  __attribute__((target("avx2")))
+  void scanBlockAvx2(const char *p, BlockMasks &m) {
+    m.quote = m.backslash = m.newline = m.special = 0;
+    for (int k = 0; k < 2; ++k) {
+      __m256i v = _mm256_loadu_si256((const __m256i*)(p + 32 * k));
+      __m256i q = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('"'));
+      __m256i bs = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\'));
+      __m256i nl = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n'));
+      __m256i sp = _mm256_or_si256(_mm256_or_si256(q, bs), nl);
+      sp = _mm256_or_si256(sp, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(';')));
+      sp = _mm256_or_si256(sp, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('[')));
+      sp = _mm256_or_si256(sp, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(']')));
+      sp = _mm256_or_si256(sp, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('(')));
+      sp = _mm256_or_si256(sp, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(')')));
+      sp = _mm256_or_si256(sp, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('{')));
+      sp = _mm256_or_si256(sp, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('}')));
+      sp = _mm256_or_si256(sp, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')));
+      sp = _mm256_or_si256(sp, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t')));
+      sp = _mm256_or_si256(sp, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r')));
+      sp = _mm256_or_si256(sp, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(',')));
+      int shift = 32 * k;
+      m.quote |= uint64_t(uint32_t(_mm256_movemask_epi8(q))) << shift;
+      m.backslash |= uint64_t(uint32_t(_mm256_movemask_epi8(bs))) << shift;
+      m.newline |= uint64_t(uint32_t(_mm256_movemask_epi8(nl))) << shift;
+      m.special |= uint64_t(uint32_t(_mm256_movemask_epi8(sp))) << shift;
+    }
+  }
+#endif
+
+  string scanBlockName = "scalar";
+
+  ScanFn pickScanBlock() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+      scanBlockName = "avx2";
+      return &scanBlockAvx2;
+    }
+#endif
+#if defined(__SSE2__)
+    scanBlockName = "sse2";
+    return &scanBlockSse2;
+#else
+    return &scanBlockScalar;
+#endif
+  }
+
+  ScanFn scanBlock = pickScanBlock();
+
+  //classifies a block shorter than 64 bytes by padding it with plain bytes
+  void scanTail(ScanFn scan, const char *p, size_t len, BlockMasks &m) {
+    char buf[64];
+    memset(buf, 'a', sizeof(buf));
+    memcpy(buf, p, len);
+    scan(buf, m);
+  }
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  inline bool eightDigits(uint64_t v) {
+    return (((v & 0xF0F0F0F0F0F0F0F0ULL) |
+             (((v + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4)) ==
+            0x3333333333333333ULL);
+  }
+
+  //converts eight ascii digits to their value with three multiplies
+  inline uint64_t parseEightDigits(uint64_t v) {
+    v -= 0x3030303030303030ULL;
+    v = (v * 10) + (v >> 8);
+    v = (((v & 0x000000FF000000FFULL) * (100 + (1000000ULL << 32))) +
+         (((v >> 16) & 0x000000FF000000FFULL) * (1 + (10000ULL << 32)))) >> 32;
+    return v;
+  }
+#endif
+
+  //parses an edn int (optional sign, optional N suffix) of up to 18 digits
+  bool scanLong(const char *p, size_t len, long long &out) {
+    size_t i = 0;
+    bool negative = false;
+    if (len && (p[0] == '-' || p[0] == '+')) {
+      negative = p[0] == '-';
+      i = 1;
+    }
+    if (len > i && p[len - 1] == 'N') len--;
+    if (i >= len || len - i > 18) return false;
+
+    uint64_t value = 0;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    while (len - i >= 8) {
+      uint64_t block;
+      memcpy(&block, p + i, 8);
+      if (!eightDigits(block)) return false;
+      value = value * 100000000ULL + parseEightDigits(block);
+      i += 8;
+    }
+#endif
+    for (; i < len; ++i) {
+      if (p[i] < '0' || p[i] > '9') return false;
+      value = value * 10 + (p[i] - '0');
+    }
+    out = negative ? -(long long)value : (long long)value;
+    return true;
+  }
+
+  bool scanLong(const string &str, long long &out) {
+    return scanLong(str.data(), str.length(), out);
+  }
+}
@@ -0,0 +1,289 @@
+#include <queue>
+#include <cstdio>
+#include <cerrno>
+#include <stdint.h>
+
+namespace datomicRest {
+
+  size_t sortMemory = 256 * 1024 * 1024;
+
+  //a row as single line edn plus its typed sort key. numbers sort before
+  //instants, instants before everything else compared as text, and missing
+  //values last. equal keys fall back to the row text so the order never
+  //depends on the order the server sent rows in
+  struct SortRow {
+    int32_t kind;
+    int32_t exact; //integer holds the number, doubles lose longs past 2^53
+    int64_t integer;
+    double number;
+    string key;
+    string text;
+
+    enum { NUMBER, INSTANT, TEXT, MISSING };
+
+    size_t bytes() const {
+      return sizeof(SortRow) + key.capacity() + text.capacity();
+    }
+  };
+
+  int compareSortRows(const SortRow &a, const SortRow &b) {
+    if (a.kind != b.kind) return a.kind < b.kind ? -1 : 1;
+    if (a.kind == SortRow::NUMBER && a.exact && b.exact && a.integer != b.integer)
+      return a.integer < b.integer ? -1 : 1;
+    if (a.kind == SortRow::NUMBER && a.number != b.number)
+      return a.number < b.number ? -1 : 1;
+    int cmp = a.key.compare(b.key);
+    if (cmp) return cmp;
+    return a.text.compare(b.text);
+  }
+
+  string sortText(edn::EdnNode &node) {
+    string text = edn::pprint(node);
+    text.erase(std::remove(text.begin(), text.end(), '\n'), text.end());
+    return text;
+  }
+
+  SortRow sortRow(edn::EdnNode &row, size_t column) {
+    SortRow sorted;
+    sorted.kind = SortRow::MISSING;
+    sorted.exact = 0;
+    sorted.integer = 0;
+    sorted.number = 0;
+    sorted.text = sortText(row);
+
+    edn::EdnNode *cell = &row;
+    if (row.type == edn::EdnVector || row.type == edn::EdnList) {
+      if (column >= row.values.size()) return sorted;
+      std::list<edn::EdnNode>::iterator it = row.values.begin();
+      std::advance(it, column);
+      cell = &*it;
+    }
+
+    if (cell->type == edn::EdnNil) return sorted;
+    if (cell->type == edn::EdnInt || cell->type == edn::EdnFloat) {
+      sorted.kind = SortRow::NUMBER;
+      sorted.number = strtod(cell->value.c_str(), NULL);
+      if (cell->type == edn::EdnInt) {
+        errno = 0;
+        sorted.integer = strtoll(cell->value.c_str(), NULL, 10);
+        sorted.exact = errno != ERANGE;
+      }
+    } else if (cell->type == edn::EdnTagged && cell->values.size() == 2 &&
+               cell->values.front().value.find("inst") != string::npos) {
+      //datomic prints every instant in utc so the text orders by time
+      sorted.kind = SortRow::INSTANT;
+      sorted.key = cell->values.back().value;
+    } else if (cell->type == edn::EdnVector || cell->type == edn::EdnList ||
+               cell->type == edn::EdnMap || cell->type == edn::EdnSet ||
+               cell->type == edn::EdnTagged) {
+      sorted.kind = SortRow::TEXT;
+      sorted.key = sortText(*cell);
+    } else {
+      sorted.kind = SortRow::TEXT;
+      sorted.key = cell->value;
+    }
+    return sorted;
+  }
+
+  //false if any part could not be written
+  bool writeSortRow(FILE *file, const SortRow &row) {
+    uint32_t keyLength = row.key.length();
+    uint32_t textLength = row.text.length();
+    return fwrite(&row.kind, sizeof(row.kind), 1, file) == 1 &&
+           fwrite(&row.exact, sizeof(row.exact), 1, file) == 1 &&
+           fwrite(&row.integer, sizeof(row.integer), 1, file) == 1 &&
+           fwrite(&row.number, sizeof(row.number), 1, file) == 1 &&
+           fwrite(&keyLength, sizeof(keyLength), 1, file) == 1 &&
+           fwrite(row.key.data(), 1, keyLength, file) == keyLength &&
+           fwrite(&textLength, sizeof(textLength), 1, file) == 1 &&
+           fwrite(row.text.data(), 1, textLength, file) == textLength;
+  }
+
+  //false at the end of the run. a row cut short or a read error sets broken
+  bool readSortRow(FILE *file, SortRow &row, bool &broken) {
+    uint32_t length;
+    if (fread(&row.kind, sizeof(row.kind), 1, file) != 1) {
+      broken = ferror(file) || !feof(file);
+      return false;
+    }
+    broken = true;
+    if (fread(&row.exact, sizeof(row.exact), 1, file) != 1) return false;
+    if (fread(&row.integer, sizeof(row.integer), 1, file) != 1) return false;
+    if (fread(&row.number, sizeof(row.number), 1, file) != 1) return false;
+    if (fread(&length, sizeof(length), 1, file) != 1) return false;
+    row.key.resize(length);
+    if (length && fread(&row.key[0], 1, length, file) != length) return false;
+    if (fread(&length, sizeof(length), 1, file) != 1) return false;
+    row.text.resize(length);
+    if (length && fread(&row.text[0], 1, length, file) != length) return false;
+    broken = false;
+    return true;
+  }
+
+  //orders a streamed result by one column before handing it to the next sink.
+  //with top only the best top rows are held in a heap; otherwise rows are
+  //sorted in memory until they pass sortMemory, then written out as sorted
+  //runs to temporary files and merged back while the output streams. a run
+  //that can not be written or read back sets error and nothing is emitted
+  //past it, so a full disk never passes for a complete result
+  class RowSorter : public RowSink {
+    RowSink &out;
+    size_t column;
+    bool descending;
+    size_t top;
+
+    struct Before {
+      bool descending;
+      //descending reverses values within a kind only, kinds keep their order
+      //and missing values stay last
+      bool operator()(const SortRow &a, const SortRow &b) const {
+        if (a.kind != b.kind) return a.kind < b.kind;
+        int cmp = compareSortRows(a, b);
+        return descending ? cmp > 0 : cmp < 0;
+      }
+    };
+    Before before;
+
+    //top of the heap is the worst row kept, so it is the one to drop
+    std::priority_queue<SortRow, vector<SortRow>, Before> best;
+    vector<SortRow> rows;
+    size_t used;
+    vector<FILE*> runs;
+    size_t memoryAt;
+
+    void emit(const SortRow &row) {
+      try {
+        edn::EdnNode node = edn::read(row.text);
+        out.row(node);
+      } catch (const char* e) {
+        if (verbose) cout << "SORT: could not reread " << row.text << endl;
+      }
+    }
+
+    //without a temporary file the rows stay in memory until the next try
+    void spill() {
+      FILE *run = tmpfile();
+      used = 0;
+      if (!run) return;
+      std::sort(rows.begin(), rows.end(), before);
+      bool written = true;
+      for (size_t i = 0; written && i < rows.size(); ++i) written = writeSortRow(run, rows[i]);
+      if (!written || fflush(run) != 0 || ferror(run)) {
+        fclose(run);
+        error = "could not write a sort run to a temporary file";
+        vector<SortRow>().swap(rows);
+        return;
+      }
+      rewind(run);
+      runs.push_back(run);
+      if (verbose) cout << "SORT: spilled run " << runs.size() << " of " << rows.size() << " rows" << endl;
+      vector<SortRow>().swap(rows);
+    }
+
+    struct RunHead {
+      SortRow row;
+      size_t run;
+    };
+
+    struct RunAfter {
+      Before before;
+      bool operator()(const RunHead &a, const RunHead &b) const {
+        return before(b.row, a.row);
+      }
+    };
+
+    //the run after the files is whatever could not be spilled
+    bool next(size_t run, SortRow &row) {
+      if (run < runs.size()) {
+        bool broken = false;
+        if (readSortRow(runs[run], row, broken)) return true;
+        if (broken && !error.length()) error = "could not read back a sort run";
+        return false;
+      }
+      if (memoryAt >= rows.size()) return false;
+      row = std::move(rows[memoryAt++]);
+      return true;
+    }
+
+    void merge() {
+      std::sort(rows.begin(), rows.end(), before);
+      RunAfter after = { before };
+      std::priority_queue<RunHead, vector<RunHead>, RunAfter> heads(after);
+      for (size_t i = 0; i <= runs.size(); ++i) {
+        RunHead head;
+        head.run = i;
+        if (next(i, head.row)) heads.push(head);
+      }
+      while (heads.size() && !error.length()) {
+        RunHead head = heads.top();
+        heads.pop();
+        emit(head.row);
+        if (next(head.run, head.row)) heads.push(head);
+      }
+    }
+
+   public:
+    string error;
+
+    RowSorter(RowSink &next, size_t sortColumn, bool sortDescending, size_t topRows = 0)
+      : out(next), column(sortColumn), descending(sortDescending), top(topRows),
+        used(0), memoryAt(0) {
+      before.descending = descending;
+      best = std::priority_queue<SortRow, vector<SortRow>, Before>(before);
+    }
+
+    ~RowSorter() {
+      for (size_t i = 0; i < runs.size(); ++i) fclose(runs[i]);
+    }
+
+    void row(edn::EdnNode &row) {
+      if (error.length()) return;
+      SortRow sorted = sortRow(row, column);
+      if (top) {
+        if (best.size() < top) {
+          best.push(std::move(sorted));
+        } else if (before(sorted, best.top())) {
+          best.pop();
+          best.push(std::move(sorted));
+        }
+        return;
+      }
+      used += sorted.bytes();
+      rows.push_back(std::move(sorted));
+      if (used > sortMemory) spill();
+    }
+
+    void done() {
+      if (top) {
+        while (best.size()) {
+          rows.push_back(best.top());
+          best.pop();
+        }
+        for (size_t i = rows.size(); i > 0; --i) emit(rows[i - 1]);
+      } else if (error.length()) {
+        vector<SortRow>().swap(rows);
+      } else if (runs.size()) {
+        if (rows.size()) spill();
+        if (!error.length()) merge();
+      } else {
+        std::sort(rows.begin(), rows.end(), before);
+        for (size_t i = 0; i < rows.size(); ++i) emit(rows[i]);
+      }
+      out.done();
+    }
+  };
+
+  //position of a :find element, matched as written e.g. ?age or (max ?age)
+  size_t findColumn(string queryString, string var) {
+    edn::EdnNode query = edn::read(queryString);
+    size_t column = 0;
+    std::list<edn::EdnNode>::iterator it;
+    for (it = query.values.begin(); it != query.values.end(); ++it) {
+      if (it->type == edn::EdnKeyword && it->value == ":find") continue;
+      if (it->type == edn::EdnKeyword) break;
+      if (sortText(*it) == var) return column;
+      column++;
+    }
+    throw "sort column is not in the :find clause";
+  }
+}
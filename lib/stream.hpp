@@ -0,0 +1,455 @@
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <map>
+
+namespace datomicRest {
+
+  //bounded single producer / single consumer ring. push and pop never block;
+  //pushWait and popWait sleep while the queue is full or empty, so a slow
+  //network idles the threads downstream of it instead of spinning them
+  template <typename T>
+  class SpscQueue {
+    vector<T> slots;
+    std::atomic<size_t> head;
+    std::atomic<size_t> tail;
+    std::atomic<bool> closed;
+    std::atomic<int> waiting;
+    std::mutex lock;
+    std::condition_variable wake;
+
+    //the fence pairs with the one in sleepUntil: either the waiter's check
+    //sees this change or this sees the waiter and takes the lock to wake it
+    void signal() {
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (waiting.load(std::memory_order_relaxed)) {
+        std::lock_guard<std::mutex> guard(lock);
+        wake.notify_all();
+      }
+    }
+
+    template <typename Ready>
+    void sleepUntil(Ready ready) {
+      std::unique_lock<std::mutex> guard(lock);
+      waiting++;
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      while (!ready()) wake.wait(guard);
+      waiting--;
+    }
+
+    bool full() {
+      return (tail.load(std::memory_order_acquire) + 1) % slots.size() ==
+             head.load(std::memory_order_acquire);
+    }
+
+    bool empty() {
+      return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+    }
+
+   public:
+    SpscQueue(size_t capacity) : slots(capacity + 1), head(0), tail(0), closed(false), waiting(0) {}
+
+    bool push(T &item) {
+      size_t t = tail.load(std::memory_order_relaxed);
+      size_t next = (t + 1) % slots.size();
+      if (next == head.load(std::memory_order_acquire)) return false;
+      slots[t] = std::move(item);
+      tail.store(next, std::memory_order_release);
+      signal();
+      return true;
+    }
+
+    bool pop(T &item) {
+      size_t h = head.load(std::memory_order_relaxed);
+      if (h == tail.load(std::memory_order_acquire)) return false;
+      item = std::move(slots[h]);
+      head.store((h + 1) % slots.size(), std::memory_order_release);
+      signal();
+      return true;
+    }
+
+    //false when the queue was closed before the item fit. a short spin
+    //first keeps a busy pipeline off the mutex
+    bool pushWait(T &item) {
+      for (int spins = 0; !push(item); ++spins) {
+        if (closed) return false;
+        if (spins < 64) std::this_thread::yield();
+        else sleepUntil([this]() { return !full() || closed; });
+      }
+      return true;
+    }
+
+    //false once the queue is closed and drained
+    bool popWait(T &item) {
+      for (int spins = 0; !pop(item); ++spins) {
+        if (closed) return pop(item);
+        if (spins < 64) std::this_thread::yield();
+        else sleepUntil([this]() { return !empty() || closed; });
+      }
+      return true;
+    }
+
+    //no more items will come, or none will be taken: wakes both ends
+    void close() {
+      closed = true;
+      signal();
+    }
+
+    bool isClosed() { return closed; }
+  };
+
+  //consumer of streamed result rows, called from the writer thread
+  class RowSink {
+   public:
+    virtual ~RowSink() {}
+    virtual void row(edn::EdnNode &row) = 0;
+    virtual void done() {}
+
+    //sinks that only pass rows on can take the text as received and skip
+    //reading it into an EdnNode and printing it back out
+    virtual bool wantsText() { return false; }
+    virtual void text(string &row) {}
+  };
+
+  //splits an edn document arriving in arbitrary chunks into the text of each
+  //element of its top level collection, e.g. each row of a query result.
+  //chunks are classified 64 bytes at a time and only structural characters
+  //go through the state machine, runs between them are copied in bulk
+  class RowSplitter {
+    int depth;
+    bool inString;
+    bool escape;
+    bool inComment;
+    bool tagged;
+    string current;
+    ScanFn scan;
+
+    void emit(vector<string> &rows) {
+      if (current.length()) rows.push_back(current);
+      current.clear();
+      tagged = false;
+    }
+
+    void plain(const char *p, size_t len) {
+      if (!inComment && depth >= 1) current.append(p, len);
+    }
+
+    void step(char c, vector<string> &rows) {
+      if (inComment) {
+        if (c == '\n') inComment = false;
+        return;
+      }
+
+      bool appended = false;
+      if (depth > 1 || (depth == 1 && (current.length() || !isDelimiter(c)))) {
+        current += c;
+        appended = true;
+      }
+
+      if (escape) {
+        escape = false;
+        return;
+      }
+      if (c == '\\') {
+        escape = true;
+        return;
+      }
+      if (inString) {
+        if (c == '"') {
+          inString = false;
+          if (depth == 1) emit(rows);
+        }
+        return;
+      }
+
+      switch (c) {
+        case '"':
+          inString = true;
+          break;
+        case ';':
+          inComment = true;
+          if (appended) current.erase(current.length() - 1);
+          break;
+        case '[': case '(': case '{':
+          depth++;
+          break;
+        case ']': case ')': case '}':
+          depth--;
+          if (depth == 0) {
+            //closing the top level collection, flush a trailing atom
+            if (appended) current.erase(current.length() - 1);
+            emit(rows);
+          } else if (depth == 1) {
+            emit(rows);
+          }
+          break;
+        case ' ': case '\t': case '\n': case '\r': case ',':
+          if (depth == 1) {
+            if (appended) current.erase(current.length() - 1);
+            if (!current.length() || *current.rbegin() == ' ') break;
+            //#inst "..." and friends carry on into the tagged value
+            if (!tagged && current[0] == '#' && current.length() > 1 &&
+                current[1] != '{' && current[1] != '_') {
+              tagged = true;
+              current += ' ';
+            } else {
+              emit(rows);
+            }
+          }
+          break;
+      }
+    }
+
+    static bool isDelimiter(char c) {
+      return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == ',';
+    }
+
+   public:
+    RowSplitter(ScanFn scanFn = scanBlock)
+      : depth(0), inString(false), escape(false), inComment(false),
+        tagged(false), scan(scanFn) {}
+
+    void feed(const string &chunk, vector<string> &rows) {
+      const char *p = chunk.data();
+      size_t len = chunk.length();
+      BlockMasks m;
+      for (size_t base = 0; base < len; base += 64) {
+        size_t n = len - base < 64 ? len - base : 64;
+        if (n == 64) scan(p + base, m);
+        else scanTail(scan, p + base, n, m);
+
+        size_t pos = 0;
+        while (pos < n) {
+          if (escape) {
+            step(p[base + pos], rows);
+            pos++;
+            continue;
+          }
+          //inside strings only quotes and escapes end the run
+          uint64_t mask = inComment ? m.newline :
+                          inString ? (m.quote | m.backslash) : m.special;
+          mask &= ~uint64_t(0) << pos;
+          size_t next = mask ? __builtin_ctzll(mask) : n;
+          if (next > n) next = n;
+          if (next > pos) plain(p + base + pos, next - pos);
+          if (next < n) step(p[base + next], rows);
+          pos = next + 1;
+        }
+      }
+    }
+  };
+
+  //times the block splitter with the scalar and dispatched scanners against
+  //a full edn::read over the same document, reporting MB/s for each
+  edn::EdnNode benchScan(string doc) {
+    double mb = doc.length() / (1024.0 * 1024.0);
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(1) << "{:bytes " << doc.length();
+
+    ScanFn scanners[] = { &scanBlockScalar, scanBlock };
+    string names[] = { ":scalar", ":" + scanBlockName };
+    for (int i = 0; i < 2; ++i) {
+      vector<string> rows;
+      RowSplitter splitter(scanners[i]);
+      double start = nowMs();
+      splitter.feed(doc, rows);
+      double elapsed = nowMs() - start;
+      if (i == 0) out << " :rows " << rows.size();
+      out << " " << names[i] << "-mb-per-sec " << mb / (elapsed / 1000.0);
+    }
+
+    double start = nowMs();
+    edn::read(doc);
+    out << " :edn-read-mb-per-sec " << mb / ((nowMs() - start) / 1000.0) << "}";
+    return edn::read(out.str());
+  }
+
+  //rows are formatted as they arrive; TBL needs every row up front to size
+  //columns so it streams as TSV
+  class RowWriter : public RowSink {
+    bool first;
+
+    //rfc 4180: quoted when needed, quotes inside doubled
+    static string csvField(const string &value, bool quote) {
+      if (!quote && value.find_first_of(",\"\r\n") == string::npos) return value;
+      string field = "\"";
+      for (unsigned i = 0; i < value.length(); ++i) {
+        if (value[i] == '"') field += '"';
+        field += value[i];
+      }
+      return field + "\"";
+    }
+
+    string cell(edn::EdnNode &node) {
+      string value;
+      if (node.type == edn::EdnString) {
+        value = node.value;
+        if (format == CSV) return csvField(value, true);
+      } else if (node.type == edn::EdnList || node.type == edn::EdnVector ||
+                 node.type == edn::EdnMap || node.type == edn::EdnSet ||
+                 node.type == edn::EdnTagged) {
+        value = edn::pprint(node);
+        value.erase(std::remove(value.begin(), value.end(), '\n'), value.end());
+      } else {
+        value = node.value;
+      }
+      return format == CSV ? csvField(value, false) : value;
+    }
+
+   public:
+    RowWriter() : first(true) {}
+
+    void row(edn::EdnNode &row) {
+      if (format == EDN || format == JSON) {
+        cout << (first ? "[" : " ") << edn::pprint(row) << "\n";
+      } else {
+        string sep = format == CSV ? "," : "\t";
+        if (first && queryHeader.values.size()) {
+          std::list<edn::EdnNode>::iterator hit;
+          for (hit = queryHeader.values.begin(); hit != queryHeader.values.end(); ++hit)
+            cout << (hit == queryHeader.values.begin() ? "" : sep)
+                 << (format == CSV ? csvField(hit->value, false) : hit->value);
+          cout << "\n";
+        }
+        if (row.type == edn::EdnVector || row.type == edn::EdnList) {
+          std::list<edn::EdnNode>::iterator it;
+          for (it = row.values.begin(); it != row.values.end(); ++it)
+            cout << (it == row.values.begin() ? "" : sep) << cell(*it);
+        } else {
+          cout << cell(row);
+        }
+        cout << "\n";
+      }
+      first = false;
+    }
+
+    void done() {
+      if (format == EDN || format == JSON) cout << (first ? "[]" : "]");
+      cout << endl;
+    }
+  };
+
+  struct StreamState {
+    SpscQueue<string> chunks;
+    SpscQueue<edn::EdnNode> rows;
+    bool failed;
+    string body;
+    string error;
+    CURL *handle;
+
+    StreamState(CURL *curlHandle) : chunks(256), rows(4096), failed(false), handle(curlHandle) {}
+  };
+
+  size_t streamWriteCallback(char* buf, size_t size, size_t nmemb, void* up) {
+    StreamState *state = (StreamState*)up;
+    long responseCode = 0;
+    curl_easy_getinfo(state->handle, CURLINFO_RESPONSE_CODE, &responseCode);
+    if (responseCode != 200 || state->failed) {
+      state->failed = true;
+      state->body.append(buf, size*nmemb);
+    } else {
+      string chunk(buf, size*nmemb);
+      state->chunks.pushWait(chunk);
+    }
+    return size*nmemb;
+  }
+
+  //receive, parse and render overlap: curl fills the chunk queue on one
+  //thread, a parser thread splits and reads complete rows, and the sink
+  //consumes them on a third. each closes its queue when done so the next
+  //stage drains it and stops
+  edn::EdnNode streamRequest(string url, RowSink &sink, CURL *handle = NULL) {
+    StreamState state(handle ? handle : curl);
+
+    std::atomic<bool> *callerCancel = cancelFlag;
+    std::thread receiver([&state, &url, callerCancel]() {
+      cancelFlag = callerCancel;
+      try {
+        perform(GET, url, "", "Accept: application/edn",
+                &streamWriteCallback, &state, state.handle);
+      } catch (const char* e) {
+        state.failed = true;
+        state.body = e;
+      }
+      state.chunks.close();
+    });
+
+    bool rawText = sink.wantsText();
+    std::thread parser([&state, rawText]() {
+      RowSplitter splitter;
+      vector<string> texts;
+      string chunk;
+      while (state.chunks.popWait(chunk)) {
+        splitter.feed(chunk, texts);
+        for (unsigned i = 0; i < texts.size(); ++i) {
+          if (rawText) {
+            //the text rides in value of an otherwise empty node
+            edn::EdnNode node;
+            node.type = edn::EdnNil;
+            node.value.swap(texts[i]);
+            state.rows.pushWait(node);
+            continue;
+          }
+          try {
+            edn::EdnNode node = edn::read(texts[i]);
+            state.rows.pushWait(node);
+          } catch (const char* e) {
+            if (!state.error.length()) state.error = e;
+          }
+        }
+        texts.clear();
+      }
+      state.rows.close();
+    });
+
+    //the sink formats against the caller's query header
+    edn::EdnNode header = queryHeader;
+    std::thread writer([&state, &sink, &header, rawText]() {
+      queryHeader = header;
+      edn::EdnNode row;
+      while (state.rows.popWait(row)) {
+        if (rawText) sink.text(row.value);
+        else sink.row(row);
+      }
+      sink.done();
+    });
+
+    receiver.join();
+    parser.join();
+    writer.join();
+
+    if (state.failed) {
+      if (verbose) cout << "DATA: " << state.body << endl;
+      return problem(state.body);
+    }
+    if (state.error.length())
+      return edn::read("\"Invalid edn in result: " + escapeString(state.error) + "\"");
+    return edn::read("nil");
+  }
+
+  edn::EdnNode streamQuery(string queryString, string extraArgs, RowSink &sink) {
+    return streamRequest(queryUrl(queryString, extraArgs), sink);
+  }
+
+  //datoms of an index as datom maps, params are the rest api's components
+  //(e a v start end) by name
+  edn::EdnNode streamDatoms(string index, std::map<string, string> params, RowSink &sink) {
+    if (asOf.length()) params["as-of"] = asOf;
+    if (since.length()) params["since"] = since;
+    if (history) params["history"] = "true";
+    if (queryOffset) params["offset"] = std::to_string(queryOffset);
+    params["limit"] = queryLimit > 0 ? std::to_string(queryLimit) : "-1";
+    params["index"] = index;
+
+    string url = "data/" + alias + "/" + db + "/-/datoms?";
+    std::map<string, string>::iterator it;
+    for (it = params.begin(); it != params.end(); ++it) {
+      char *value = curl_easy_escape(curl, it->second.c_str(), 0);
+      url += (it == params.begin() ? "" : "&") + it->first + "=" + string(value);
+      curl_free(value);
+    }
+    queryHeader = edn::read("[]");
+    return streamRequest(url, sink);
+  }
+}
@@ -0,0 +1,258 @@
+#include <random>
+#include <cmath>
+#include <cerrno>
+#include <functional>
+#include <stdint.h>
+
+namespace datomicRest {
+
+  //keeps a uniform sample of n rows from a stream of unknown length
+  class RowSampler : public RowSink {
+    size_t size;
+    size_t seen;
+    std::mt19937_64 random;
+
+   public:
+    vector<edn::EdnNode> rows;
+
+    RowSampler(size_t n) : size(n), seen(0), random(std::random_device()()) {}
+
+    void row(edn::EdnNode &row) {
+      seen++;
+      if (rows.size() < size) {
+        rows.push_back(std::move(row));
+        return;
+      }
+      size_t slot = std::uniform_int_distribution<size_t>(0, seen - 1)(random);
+      if (slot < size) rows[slot] = std::move(row);
+    }
+
+    size_t total() { return seen; }
+  };
+
+  inline uint64_t mixHash(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+  }
+
+  //hyperloglog with 4096 registers, about 1.6% error on distinct counts
+  class DistinctSketch {
+    static const int bits = 12;
+    static const int registers = 1 << bits;
+    uint8_t ranks[registers];
+
+   public:
+    DistinctSketch() {
+      for (int i = 0; i < registers; ++i) ranks[i] = 0;
+    }
+
+    void add(const string &value) {
+      uint64_t h = mixHash(std::hash<string>()(value));
+      uint32_t slot = h >> (64 - bits);
+      uint64_t rest = (h << bits) | (1ULL << (bits - 1));
+      uint8_t rank = __builtin_clzll(rest) + 1;
+      if (rank > ranks[slot]) ranks[slot] = rank;
+    }
+
+    double estimate() {
+      double sum = 0;
+      int zeros = 0;
+      for (int i = 0; i < registers; ++i) {
+        sum += std::ldexp(1.0, -ranks[i]);
+        if (!ranks[i]) zeros++;
+      }
+      double m = registers;
+      double raw = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+      if (raw <= 2.5 * m && zeros) return m * std::log(m / zeros);
+      return raw;
+    }
+  };
+
+  //kll style quantiles: level i holds values standing for 2^i rows each.
+  //a full level is sorted and every other value, from a random start, moves
+  //up a level, so memory stays at a few levels of k values
+  class QuantileSketch {
+    size_t k;
+    vector<vector<double> > levels;
+    std::mt19937 random;
+
+    void compact(size_t level) {
+      if (levels.size() == level + 1) levels.push_back(vector<double>());
+      vector<double> &values = levels[level];
+      std::sort(values.begin(), values.end());
+      for (size_t i = random() % 2; i < values.size(); i += 2)
+        levels[level + 1].push_back(values[i]);
+      values.clear();
+      if (levels[level + 1].size() >= k) compact(level + 1);
+    }
+
+   public:
+    QuantileSketch(size_t size = 256) : k(size), levels(1), random(7) {}
+
+    void add(double value) {
+      levels[0].push_back(value);
+      if (levels[0].size() >= k) compact(0);
+    }
+
+    double quantile(double q) {
+      vector<std::pair<double, double> > weighted;
+      double total = 0;
+      for (size_t level = 0; level < levels.size(); ++level)
+        for (size_t i = 0; i < levels[level].size(); ++i) {
+          weighted.push_back(std::make_pair(levels[level][i], double(1ULL << level)));
+          total += 1ULL << level;
+        }
+      if (!weighted.size()) return 0;
+      std::sort(weighted.begin(), weighted.end());
+      double seen = 0;
+      for (size_t i = 0; i < weighted.size(); ++i) {
+        seen += weighted[i].second;
+        if (seen >= q * total) return weighted[i].first;
+      }
+      return weighted.back().first;
+    }
+  };
+
+  struct ColumnSummary {
+    size_t rows;
+    size_t nils;
+    size_t numbers;
+    double minNumber;
+    double maxNumber;
+    //ints kept exact, a double drops the low digits of ids past 2^53
+    size_t integers;
+    long long minInteger;
+    long long maxInteger;
+    string minText;
+    string maxText;
+    size_t texts;
+    DistinctSketch distinct;
+    QuantileSketch quantiles;
+    TopCounter frequent;
+
+    ColumnSummary() : rows(0), nils(0), numbers(0), minNumber(0), maxNumber(0),
+                      integers(0), minInteger(0), maxInteger(0), texts(0), frequent(32) {}
+
+    void add(edn::EdnNode &cell) {
+      rows++;
+      if (cell.type == edn::EdnNil) {
+        nils++;
+        return;
+      }
+
+      string text = cell.value;
+      if (cell.type == edn::EdnVector || cell.type == edn::EdnList || cell.type == edn::EdnMap ||
+          cell.type == edn::EdnSet || cell.type == edn::EdnTagged) {
+        text = edn::pprint(cell);
+        text.erase(std::remove(text.begin(), text.end(), '\n'), text.end());
+      }
+      distinct.add(text);
+      frequent.add(text);
+
+      if (cell.type == edn::EdnInt || cell.type == edn::EdnFloat) {
+        double number = strtod(cell.value.c_str(), NULL);
+        if (!numbers || number < minNumber) minNumber = number;
+        if (!numbers || number > maxNumber) maxNumber = number;
+        if (cell.type == edn::EdnInt) {
+          errno = 0;
+          long long integer = strtoll(cell.value.c_str(), NULL, 10);
+          if (errno != ERANGE) {
+            if (!integers || integer < minInteger) minInteger = integer;
+            if (!integers || integer > maxInteger) maxInteger = integer;
+            integers++;
+          }
+        }
+        numbers++;
+        quantiles.add(number);
+      } else {
+        if (!texts || text < minText) minText = text;
+        if (!texts || text > maxText) maxText = text;
+        texts++;
+      }
+    }
+  };
+
+  //per column statistics in one pass and fixed memory per column
+  class RowSummary : public RowSink {
+    vector<ColumnSummary> columns;
+    size_t rows;
+
+    //the fewest digits that read back as the same double, at most 17
+    static string number(double value) {
+      string text;
+      for (int digits = 15; digits <= 17; ++digits) {
+        std::ostringstream out;
+        out << std::setprecision(digits) << value;
+        text = out.str();
+        if (strtod(text.c_str(), NULL) == value) break;
+      }
+      return text.find("inf") == string::npos && text.find("nan") == string::npos ?
+             text : "\"" + text + "\"";
+    }
+
+    static string quoted(const string &text) {
+      return "\"" + escapeString(text) + "\"";
+    }
+
+   public:
+    RowSummary() : rows(0) {}
+
+    void row(edn::EdnNode &row) {
+      rows++;
+      if (row.type != edn::EdnVector && row.type != edn::EdnList) {
+        if (!columns.size()) columns.resize(1);
+        columns[0].add(row);
+        return;
+      }
+      if (columns.size() < row.values.size()) columns.resize(row.values.size());
+      size_t c = 0;
+      std::list<edn::EdnNode>::iterator it;
+      for (it = row.values.begin(); it != row.values.end(); ++it, ++c) columns[c].add(*it);
+    }
+
+    //one row per column; sets header to its column names
+    edn::EdnNode result(edn::EdnNode &names, edn::EdnNode &header) {
+      vector<string> labels;
+      std::list<edn::EdnNode>::iterator nit;
+      for (nit = names.values.begin(); nit != names.values.end(); ++nit) labels.push_back(nit->value);
+
+      std::ostringstream out;
+      out << "[";
+      for (size_t c = 0; c < columns.size(); ++c) {
+        ColumnSummary &col = columns[c];
+        std::ostringstream label;
+        if (c < labels.size()) label << labels[c];
+        else label << c;
+
+        out << "[" << quoted(label.str()) << " " << col.rows << " " << col.nils << " "
+            << (long long)(col.distinct.estimate() + 0.5) << " ";
+        if (col.numbers) {
+          if (col.integers == col.numbers) out << col.minInteger << " " << col.maxInteger << " ";
+          else out << number(col.minNumber) << " " << number(col.maxNumber) << " ";
+          out << number(col.quantiles.quantile(0.5)) << " "
+              << number(col.quantiles.quantile(0.9)) << " "
+              << number(col.quantiles.quantile(0.99)) << " ";
+        } else if (col.texts) {
+          out << quoted(col.minText) << " " << quoted(col.maxText) << " nil nil nil ";
+        } else {
+          out << "nil nil nil nil nil ";
+        }
+
+        vector<std::pair<string, long long> > top = col.frequent.top(3);
+        std::ostringstream common;
+        for (size_t i = 0; i < top.size(); ++i)
+          common << (i ? ", " : "") << top[i].first << " (" << top[i].second << ")";
+        out << quoted(common.str()) << "]";
+      }
+      out << "]";
+
+      header = edn::read("[\"column\" \"rows\" \"nil\" \"distinct~\" \"min\" \"max\" "
+                         "\"p50\" \"p90\" \"p99\" \"most common\"]");
+      return edn::read(out.str());
+    }
+  };
+}
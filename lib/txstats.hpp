@@ -0,0 +1,362 @@
+#include <unordered_map>
+#include <chrono>
+
+namespace datomicRest {
+
+  //per second counts for the last minute, slots are reused as time moves on
+  class RateRing {
+    static const int slots = 60;
+    long long stamps[slots];
+    double txs[slots];
+    double datoms[slots];
+
+   public:
+    RateRing() {
+      for (int i = 0; i < slots; ++i) {
+        stamps[i] = -1;
+        txs[i] = datoms[i] = 0;
+      }
+    }
+
+    void add(long long second, double txCount, double datomCount) {
+      int slot = second % slots;
+      if (stamps[slot] != second) {
+        stamps[slot] = second;
+        txs[slot] = datoms[slot] = 0;
+      }
+      txs[slot] += txCount;
+      datoms[slot] += datomCount;
+    }
+
+    //average per second over the window of complete seconds before now
+    double rate(long long now, int window, bool ofDatoms) {
+      double total = 0;
+      for (int i = 0; i < slots; ++i)
+        if (stamps[i] < now && stamps[i] >= now - window)
+          total += ofDatoms ? datoms[i] : txs[i];
+      return total / window;
+    }
+  };
+
+  //space saving top-k: a fixed set of counters, a new key takes over the
+  //smallest one and inherits its count as its error bound
+  class TopCounter {
+    size_t capacity;
+    vector<std::pair<string, long long> > counters;
+    std::unordered_map<string, size_t> index;
+
+   public:
+    TopCounter(size_t size = 64) : capacity(size) {}
+
+    void add(const string &key, long long n = 1) {
+      std::unordered_map<string, size_t>::iterator it = index.find(key);
+      if (it != index.end()) {
+        counters[it->second].second += n;
+        return;
+      }
+      if (counters.size() < capacity) {
+        index[key] = counters.size();
+        counters.push_back(std::make_pair(key, n));
+        return;
+      }
+      size_t smallest = 0;
+      for (size_t i = 1; i < counters.size(); ++i)
+        if (counters[i].second < counters[smallest].second) smallest = i;
+      index.erase(counters[smallest].first);
+      index[key] = smallest;
+      counters[smallest].first = key;
+      counters[smallest].second += n;
+    }
+
+    vector<std::pair<string, long long> > top(size_t k) {
+      vector<std::pair<string, long long> > sorted(counters);
+      std::sort(sorted.begin(), sorted.end(),
+                [](const std::pair<string, long long> &a, const std::pair<string, long long> &b) {
+                  return a.second != b.second ? a.second > b.second : a.first < b.first;
+                });
+      if (sorted.size() > k) sorted.resize(k);
+      return sorted;
+    }
+  };
+
+  //datoms per transaction in buckets growing by a tenth, good to within
+  //that for any percentile in under 2k
+  class SizeHistogram {
+    static const int buckets = 200;
+    long long counts[buckets];
+    long long total;
+    long long largest;
+
+    static int bucket(long long size) {
+      int b = 0;
+      double bound = 1;
+      while (size > bound && b < buckets - 1) {
+        bound *= 1.1;
+        b++;
+      }
+      return b;
+    }
+
+    static long long upper(int b) {
+      double bound = 1;
+      for (int i = 0; i < b; ++i) bound *= 1.1;
+      return (long long)bound;
+    }
+
+   public:
+    SizeHistogram() : total(0), largest(0) {
+      for (int i = 0; i < buckets; ++i) counts[i] = 0;
+    }
+
+    void add(long long size) {
+      counts[bucket(size)]++;
+      total++;
+      if (size > largest) largest = size;
+    }
+
+    long long percentile(double p) {
+      if (!total) return 0;
+      long long rank = (long long)(p * total);
+      long long seen = 0;
+      for (int i = 0; i < buckets; ++i) {
+        seen += counts[i];
+        if (seen > rank) return std::min(upper(i), largest);
+      }
+      return largest;
+    }
+
+    long long max() { return largest; }
+    long long count() { return total; }
+  };
+
+  //receives the events stream on its own connection. events are small
+  //maps carrying the new :basis-t; when the consumer falls behind they are
+  //counted and dropped rather than queued without bound
+  struct EventFeed {
+    SpscQueue<string> events;
+    string line;
+    std::atomic<long long> dropped;
+    std::atomic<bool> running;
+
+    EventFeed() : events(4096), dropped(0), running(true) {}
+  };
+
+  size_t eventCallback(char* buf, size_t size, size_t nmemb, void* up) {
+    EventFeed *feed = (EventFeed*)up;
+    for (size_t i = 0; i < size*nmemb; ++i) {
+      if (buf[i] != '\n') {
+        feed->line += buf[i];
+        continue;
+      }
+      if (feed->line.compare(0, 5, "data:") == 0) {
+        string event = feed->line.substr(5);
+        if (!feed->events.push(event)) feed->dropped++;
+      }
+      feed->line.clear();
+    }
+    return size*nmemb;
+  }
+
+  //counts the rows [tx ident datoms] of txRangeQuery
+  class TxDatoms : public RowSink {
+    std::unordered_map<long long, long long> perTx;
+
+   public:
+    TopCounter &attributes;
+    TopCounter &namespaces;
+    long long datoms;
+
+    TxDatoms(TopCounter &attrs, TopCounter &nss)
+      : attributes(attrs), namespaces(nss), datoms(0) {}
+
+    void row(edn::EdnNode &counted) {
+      if (counted.values.size() != 3) return;
+      std::list<edn::EdnNode>::iterator it = counted.values.begin();
+      long long tx = 0;
+      long long n = 0;
+      scanLong(it->value, tx);
+      string a = (++it)->value;
+      scanLong((++it)->value, n);
+
+      datoms += n;
+      perTx[tx] += n;
+      attributes.add(a, n);
+      size_t slash = a.find('/');
+      namespaces.add(slash == string::npos ? a : a.substr(0, slash), n);
+    }
+
+    //datoms per transaction, keyed by t
+    void sizes(std::unordered_map<long long, long long> &out) {
+      std::unordered_map<long long, long long>::iterator it;
+      for (it = perTx.begin(); it != perTx.end(); ++it)
+        out[it->first & ((1LL << 42) - 1)] += it->second;
+    }
+  };
+
+  //datoms per transaction and attribute for t in [?t1 ?t2), read from the
+  //transaction log so the cost follows the new transactions rather than the
+  //size of the db. idents are joined in the query, nothing is cached here
+  const string txRangeQuery =
+    "[:find ?tx ?ident (count ?e) :with ?v ?added :in $ ?log ?t1 ?t2 "
+    " :where [(tx-ids ?log ?t1 ?t2) [?tx ...]] "
+           " [(tx-data ?log ?tx) [[?e ?a ?v _ ?added]]] "
+           " [?a :db/ident ?ident]]";
+
+  class TxStats {
+    RateRing rates;
+    TopCounter attributes;
+    TopCounter namespaces;
+    SizeHistogram sizes;
+    //arrival second of each t not yet fetched, so datoms land in the
+    //second their transaction happened rather than when they were read
+    std::unordered_map<long long, long long> arrivals;
+    long long latest;
+    long long fetched;
+    long long txs;
+    long long datoms;
+
+    string json(const string &str) {
+      return "\"" + escapeString(str) + "\"";
+    }
+
+   public:
+    TxStats() : latest(0), fetched(0), txs(0), datoms(0) {}
+
+    void start() {
+      string basis = currentBasis();
+      if (basis != "-") fetched = latest = atoll(basis.c_str());
+    }
+
+    void event(const string &text, long long second) {
+      size_t at = text.find(":basis-t");
+      long long t = 0;
+      if (at == string::npos) return;
+      at = text.find_first_of("0123456789", at);
+      size_t end = text.find_first_not_of("0123456789", at);
+      if (at == string::npos || !scanLong(text.substr(at, end - at), t)) return;
+      txs++;
+      rates.add(second, 1, 0);
+      if (arrivals.size() < 100000) arrivals[t] = second;
+      if (t > latest) latest = t;
+      if (!fetched) fetched = t;
+    }
+
+    //one log range read covers every transaction since the last refresh
+    edn::EdnNode refresh(long long second) {
+      if (latest <= fetched) return edn::read("nil");
+
+      TxDatoms counted(attributes, namespaces);
+      //the log is named by the same :db/alias map as a db input
+      std::ostringstream range;
+      range << "[{:db/alias \"" << escapeString(alias + "/" + db) << "\" :log true} "
+            << fetched + 1 << " " << latest + 1 << "]";
+      edn::EdnNode result = streamRequest(queryUrl(txRangeQuery, range.str(),
+                                                   dbArgAt("", "", false)), counted);
+      if (result.type != edn::EdnNil) return result;
+
+      std::unordered_map<long long, long long> perTx;
+      counted.sizes(perTx);
+      std::unordered_map<long long, long long>::iterator it;
+      for (it = perTx.begin(); it != perTx.end(); ++it) {
+        sizes.add(it->second);
+        std::unordered_map<long long, long long>::iterator arrived = arrivals.find(it->first);
+        rates.add(arrived == arrivals.end() ? second : arrived->second, 0, it->second);
+      }
+      datoms += counted.datoms;
+      arrivals.clear();
+      fetched = latest;
+      return edn::read("nil");
+    }
+
+    void render(long long second, long long dropped) {
+      vector<std::pair<string, long long> > topAttrs = attributes.top(10);
+      vector<std::pair<string, long long> > topNss = namespaces.top(10);
+
+      if (format == JSON) {
+        std::ostringstream out;
+        out << "{\"time\":" << second << ",\"basis_t\":" << latest
+            << ",\"txs\":" << txs << ",\"datoms\":" << datoms << ",\"dropped\":" << dropped
+            << ",\"tx_per_sec_10s\":" << rates.rate(second, 10, false)
+            << ",\"tx_per_sec_60s\":" << rates.rate(second, 60, false)
+            << ",\"datoms_per_sec_10s\":" << rates.rate(second, 10, true)
+            << ",\"datoms_per_sec_60s\":" << rates.rate(second, 60, true)
+            << ",\"tx_size\":{\"p50\":" << sizes.percentile(0.5) << ",\"p90\":" << sizes.percentile(0.9)
+            << ",\"p99\":" << sizes.percentile(0.99) << ",\"max\":" << sizes.max() << "}"
+            << ",\"attributes\":{";
+        for (size_t i = 0; i < topAttrs.size(); ++i)
+          out << (i ? "," : "") << json(topAttrs[i].first) << ":" << topAttrs[i].second;
+        out << "},\"namespaces\":{";
+        for (size_t i = 0; i < topNss.size(); ++i)
+          out << (i ? "," : "") << json(topNss[i].first) << ":" << topNss[i].second;
+        out << "}}";
+        cout << out.str() << endl;
+        return;
+      }
+
+      cout << "\x1b[2J\x1b[1;1H";
+      cout << alias << "/" << db << "  basis-t " << latest << "  txs " << txs
+           << "  datoms " << datoms;
+      if (dropped) cout << "  dropped events " << dropped;
+      cout << "\n\n" << left << setw(14) << "" << setw(12) << "10s" << "60s\n"
+           << setw(14) << "tx/sec" << setw(12) << rates.rate(second, 10, false)
+           << rates.rate(second, 60, false) << "\n"
+           << setw(14) << "datoms/sec" << setw(12) << rates.rate(second, 10, true)
+           << rates.rate(second, 60, true) << "\n\n"
+           << "tx size  p50 " << sizes.percentile(0.5) << "  p90 " << sizes.percentile(0.9)
+           << "  p99 " << sizes.percentile(0.99) << "  max " << sizes.max() << "\n\n"
+           << setw(40) << "attributes" << "namespaces\n";
+      for (size_t i = 0; i < topAttrs.size() || i < topNss.size(); ++i) {
+        std::ostringstream attr;
+        std::ostringstream ns;
+        if (i < topAttrs.size()) attr << topAttrs[i].first << " " << topAttrs[i].second;
+        if (i < topNss.size()) ns << topNss[i].first << " " << topNss[i].second;
+        cout << setw(40) << attr.str() << ns.str() << "\n";
+      }
+      cout << std::flush;
+    }
+  };
+
+  //follows the events stream until it ends, rendering every interval seconds.
+  //TBL redraws the terminal, JSON writes one line per interval
+  edn::EdnNode txStats(int interval) {
+    if (interval < 1) interval = 1;
+    TxStats stats;
+    stats.start();
+
+    EventFeed feed;
+    std::atomic<bool> stop(false);
+    std::thread receiver([&feed, &stop]() {
+      cancelFlag = &stop;
+      CURL *handle = curl_easy_init();
+      try {
+        perform(GET, "events/" + alias + "/" + db, "", "Accept: text/event-stream",
+                &eventCallback, &feed, handle);
+      } catch (const char* e) {
+      }
+      curl_easy_cleanup(handle);
+      feed.running = false;
+    });
+
+    long long nextRender = 0;
+    edn::EdnNode result = edn::read("nil");
+    while (true) {
+      bool ended = !feed.running;
+      long long second = (long long)(nowMs() / 1000);
+      string event;
+      while (feed.events.pop(event)) stats.event(event, second);
+
+      if (second >= nextRender) {
+        result = stats.refresh(second);
+        if (result.type != edn::EdnNil) break;
+        stats.render(second, feed.dropped);
+        nextRender = second + interval;
+      }
+      if (ended) break;
+      std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+
+    stop = true;
+    receiver.join();
+    return result.type == edn::EdnNil ? edn::read("\"events stream ended\"") : result;
+  }
+}
@@ -0,0 +1,393 @@
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <memory>
+
+namespace datomicRest {
+
+  struct AttrSchema {
+    string valueType;
+    bool many;
+    string unique;
+  };
+
+  struct DbSchema {
+    std::unordered_map<string, AttrSchema> attrs;
+    std::unordered_set<string> idents;
+  };
+
+  //every attribute and ident of the db, loaded once and shared read only by
+  //every validation until a transaction that touches :db/ident invalidates it
+  class SchemaCache {
+    std::mutex lock;
+    std::shared_ptr<const DbSchema> schema;
+
+    std::shared_ptr<const DbSchema> load() {
+      std::shared_ptr<DbSchema> loaded(new DbSchema());
+      std::unordered_map<string, AttrSchema> &attrs = loaded->attrs;
+      edn::EdnNode rows = query("[:find ?ident ?valueType ?cardinality "
+                                " :where [?e :db/valueType ?v] "
+                                       " [?e :db/ident ?ident] "
+                                       " [?v :db/ident ?valueType] "
+                                       " [?e :db/cardinality ?c] "
+                                       " [?c :db/ident ?cardinality]]");
+      if (rows.type == edn::EdnString) throw "could not load the schema to validate against";
+      std::list<edn::EdnNode>::iterator it;
+      for (it = rows.values.begin(); it != rows.values.end(); ++it) {
+        vector<edn::EdnNode> row(it->values.begin(), it->values.end());
+        if (row.size() < 3) continue;
+        AttrSchema attr = { row[1].value, row[2].value == ":db.cardinality/many", "" };
+        attrs[row[0].value] = attr;
+      }
+
+      rows = query("[:find ?ident ?unique :where [?e :db/unique ?u] "
+                   " [?e :db/ident ?ident] [?u :db/ident ?unique]]");
+      for (it = rows.values.begin(); it != rows.values.end(); ++it)
+        if (it->values.size() == 2 && attrs.count(it->values.front().value))
+          attrs[it->values.front().value].unique = it->values.back().value;
+
+      rows = query("[:find ?ident :where [_ :db/ident ?ident]]");
+      for (it = rows.values.begin(); it != rows.values.end(); ++it)
+        if (it->values.size()) loaded->idents.insert(it->values.front().value);
+      return loaded;
+    }
+
+   public:
+    void invalidate() {
+      std::lock_guard<std::mutex> guard(lock);
+      schema.reset();
+    }
+
+    //the current schema, never changed once built so no copy is needed
+    std::shared_ptr<const DbSchema> snapshot() {
+      std::lock_guard<std::mutex> guard(lock);
+      if (!schema) schema = load();
+      return schema;
+    }
+  };
+
+  SchemaCache txSchema;
+
+  struct TxError {
+    size_t form;
+    string attribute;
+    string message;
+  };
+
+  //checks tx data against the cached schema: unknown attributes and idents,
+  //value types, cardinality, two values asserted for one cardinality one
+  //attribute of an entity, two entities claiming one unique value and
+  //tempids referenced but never asserted.
+  //positions are indexes of the top level forms of the transaction
+  class TxValidator {
+    std::shared_ptr<const DbSchema> schema;
+
+    //attributes and idents defined earlier in the transaction being checked
+    std::unordered_map<string, AttrSchema> learnedAttrs;
+    std::unordered_set<string> learnedIdents;
+
+    std::unordered_map<string, string> uniqueOwners;
+    std::unordered_map<string, string> singleValues;
+    std::unordered_set<string> asserted;
+    std::unordered_map<string, size_t> referenced;
+    size_t autoIds;
+
+    void error(size_t form, string attribute, string message) {
+      TxError e = { form, attribute, message };
+      errors.push_back(e);
+    }
+
+    static string text(edn::EdnNode &node) {
+      if (node.type != edn::EdnList && node.type != edn::EdnVector &&
+          node.type != edn::EdnMap && node.type != edn::EdnSet &&
+          node.type != edn::EdnTagged)
+        return node.value;
+      string out = edn::pprint(node);
+      out.erase(std::remove(out.begin(), out.end(), '\n'), out.end());
+      return out;
+    }
+
+    static bool hasTag(edn::EdnNode &node, string tag) {
+      return node.type == edn::EdnTagged && node.values.size() == 2 &&
+             node.values.front().value.find(tag) != string::npos;
+    }
+
+    //the entity a map or :db/add names, registering tempids along the way.
+    //a tempid is its partition and index, -1 in two partitions is two entities
+    string entityKey(edn::EdnNode &node, size_t form, bool asserting) {
+      if (!hasTag(node, "db/id")) return text(node);
+      edn::EdnNode &spec = node.values.back();
+      if (spec.values.size() < 2) {
+        std::ostringstream key;
+        key << "#auto" << autoIds++;
+        return key.str();
+      }
+      string key = "#db/id [" + spec.values.front().value + " " + spec.values.back().value + "]";
+      if (asserting) asserted.insert(key);
+      else if (!referenced.count(key)) referenced[key] = form;
+      return key;
+    }
+
+    const AttrSchema *findAttr(const string &ident) {
+      std::unordered_map<string, AttrSchema>::const_iterator it = learnedAttrs.find(ident);
+      if (it != learnedAttrs.end()) return &it->second;
+      it = schema->attrs.find(ident);
+      return it == schema->attrs.end() ? NULL : &it->second;
+    }
+
+    bool knownIdent(const string &ident) {
+      return learnedIdents.count(ident) || schema->idents.count(ident);
+    }
+
+    bool isTempid(const string &key) {
+      return key.length() && (key[0] == '-' || key[0] == '#');
+    }
+
+    bool lookupRef(edn::EdnNode &value) {
+      if (value.type != edn::EdnVector || value.values.size() != 2) return false;
+      if (value.values.front().type != edn::EdnKeyword) return false;
+      const AttrSchema *attr = findAttr(value.values.front().value);
+      return attr && attr->unique.length();
+    }
+
+    bool fits(const AttrSchema &attr, edn::EdnNode &value, size_t form, string &why) {
+      const string &type = attr.valueType;
+      edn::NodeType t = value.type;
+      bool ok;
+      if (type == ":db.type/string") ok = t == edn::EdnString;
+      else if (type == ":db.type/long" || type == ":db.type/bigint") ok = t == edn::EdnInt;
+      else if (type == ":db.type/boolean") ok = t == edn::EdnBool;
+      else if (type == ":db.type/double" || type == ":db.type/float" || type == ":db.type/bigdec")
+        ok = t == edn::EdnFloat;
+      else if (type == ":db.type/instant") ok = hasTag(value, "inst");
+      else if (type == ":db.type/uuid") ok = hasTag(value, "uuid");
+      else if (type == ":db.type/uri") ok = hasTag(value, "uri") || t == edn::EdnString;
+      else if (type == ":db.type/keyword") ok = t == edn::EdnKeyword;
+      else if (type == ":db.type/ref") {
+        if (t == edn::EdnKeyword) {
+          ok = knownIdent(value.value);
+          if (!ok) why = "unknown ident " + value.value;
+          return ok;
+        }
+        if (hasTag(value, "db/id")) {
+          entityKey(value, form, false);
+          return true;
+        }
+        ok = t == edn::EdnInt || lookupRef(value);
+      } else ok = true;
+      if (!ok) why = "expects " + type + ", got " + text(value);
+      return ok;
+    }
+
+    void claimUnique(const string &attrIdent, const AttrSchema &attr, const string &entity,
+                     edn::EdnNode &value, size_t form) {
+      string key = attrIdent + " " + text(value);
+      std::unordered_map<string, string>::iterator it = uniqueOwners.find(key);
+      if (it == uniqueOwners.end()) {
+        uniqueOwners[key] = entity;
+        return;
+      }
+      if (it->second == entity) return;
+      //tempids sharing an identity value resolve to one entity
+      if (attr.unique == ":db.unique/identity" && isTempid(it->second) && isTempid(entity)) return;
+      error(form, attrIdent, "value " + text(value) + " is unique but given to two entities");
+    }
+
+    //datomic refuses a transaction asserting two values of a cardinality one
+    //attribute for one entity
+    void claimSingle(const string &attrIdent, const string &entity, edn::EdnNode &value,
+                     size_t form) {
+      string key = attrIdent + " " + entity;
+      string given = text(value);
+      std::unordered_map<string, string>::iterator it = singleValues.find(key);
+      if (it == singleValues.end()) {
+        singleValues[key] = given;
+        return;
+      }
+      if (it->second != given)
+        error(form, attrIdent, "is cardinality one but given " + it->second + " and " + given);
+    }
+
+    void checkValue(const string &attrIdent, const string &entity, edn::EdnNode &value,
+                    size_t form, bool retracting) {
+      string ident = attrIdent;
+      bool reverse = ident.find("/_") != string::npos;
+      if (reverse) ident.erase(ident.find("/_") + 1, 1);
+
+      const AttrSchema *found = findAttr(ident);
+      if (!found) {
+        error(form, attrIdent, "unknown attribute");
+        return;
+      }
+      const AttrSchema &attr = *found;
+      if (reverse && attr.valueType != ":db.type/ref") {
+        error(form, attrIdent, "reverse attribute of a non ref");
+        return;
+      }
+
+      vector<edn::EdnNode*> values;
+      bool collection = (value.type == edn::EdnVector || value.type == edn::EdnSet ||
+                         value.type == edn::EdnList) && !lookupRef(value);
+      if (collection && (attr.many || reverse)) {
+        std::list<edn::EdnNode>::iterator vit;
+        for (vit = value.values.begin(); vit != value.values.end(); ++vit) values.push_back(&*vit);
+      } else if (collection) {
+        error(form, attrIdent, "is cardinality one but given " + text(value));
+        return;
+      } else {
+        values.push_back(&value);
+      }
+
+      for (unsigned i = 0; i < values.size(); ++i) {
+        string why;
+        if (values[i]->type == edn::EdnMap && (attr.valueType == ":db.type/ref" || reverse)) {
+          checkMap(*values[i], form);
+          continue;
+        }
+        if (reverse) {
+          AttrSchema ref = { ":db.type/ref", false, "" };
+          if (!fits(ref, *values[i], form, why)) error(form, attrIdent, why);
+          continue;
+        }
+        if (!fits(attr, *values[i], form, why)) {
+          error(form, attrIdent, why);
+          continue;
+        }
+        if (retracting) continue;
+        if (!attr.many) claimSingle(ident, entity, *values[i], form);
+        if (attr.unique.length()) claimUnique(ident, attr, entity, *values[i], form);
+      }
+    }
+
+    //attributes defined in this transaction count as known for the rest of it
+    void learnAttribute(edn::EdnNode &map) {
+      string ident, valueType, unique;
+      bool many = false;
+      std::list<edn::EdnNode>::iterator it = map.values.begin();
+      while (it != map.values.end()) {
+        std::list<edn::EdnNode>::iterator value = it;
+        if (++value == map.values.end()) break;
+        if (it->value == ":db/ident") ident = value->value;
+        else if (it->value == ":db/valueType") valueType = value->value;
+        else if (it->value == ":db/cardinality") many = value->value == ":db.cardinality/many";
+        else if (it->value == ":db/unique") unique = value->value;
+        it = ++value;
+      }
+      if (ident.length()) learnedIdents.insert(ident);
+      if (ident.length() && valueType.length()) {
+        AttrSchema attr = { valueType, many, unique };
+        learnedAttrs[ident] = attr;
+      }
+    }
+
+    void checkMap(edn::EdnNode &map, size_t form) {
+      learnAttribute(map);
+      string entity;
+      std::list<edn::EdnNode>::iterator it = map.values.begin();
+      while (it != map.values.end()) {
+        std::list<edn::EdnNode>::iterator value = it;
+        if (++value == map.values.end()) break;
+        if (it->value == ":db/id") entity = entityKey(*value, form, true);
+        it = ++value;
+      }
+      if (!entity.length()) entity = entityKey(map, form, true) + "#nested";
+
+      for (it = map.values.begin(); it != map.values.end(); ++it) {
+        std::list<edn::EdnNode>::iterator value = it;
+        if (++value == map.values.end()) {
+          error(form, "", "map has a key without a value");
+          break;
+        }
+        if (it->type != edn::EdnKeyword) error(form, text(*it), "attribute must be a keyword");
+        else if (it->value != ":db/id") checkValue(it->value, entity, *value, form, false);
+        it = value;
+      }
+    }
+
+    void checkList(edn::EdnNode &list, size_t form) {
+      vector<edn::EdnNode*> parts;
+      std::list<edn::EdnNode>::iterator it;
+      for (it = list.values.begin(); it != list.values.end(); ++it) parts.push_back(&*it);
+      if (!parts.size() || parts[0]->type != edn::EdnKeyword) {
+        error(form, "", "expected [:db/add e a v], [:db/retract e a v] or [:fn args]");
+        return;
+      }
+
+      string op = parts[0]->value;
+      if (op == ":db/add" || op == ":db/retract") {
+        if (parts.size() != 4) {
+          error(form, op, "expects e a v");
+          return;
+        }
+        string entity = entityKey(*parts[1], form, op == ":db/add");
+        if (parts[2]->type != edn::EdnKeyword) {
+          error(form, text(*parts[2]), "attribute must be a keyword");
+          return;
+        }
+        checkValue(parts[2]->value, entity, *parts[3], form, op == ":db/retract");
+      } else if (!knownIdent(op)) {
+        error(form, op, "unknown transaction function");
+      } else {
+        for (unsigned i = 1; i < parts.size(); ++i)
+          if (hasTag(*parts[i], "db/id")) entityKey(*parts[i], form, false);
+      }
+    }
+
+   public:
+    vector<TxError> errors;
+
+    TxValidator() : autoIds(0) {}
+
+    //loads the schema on first use, throws if it can not
+    void check(edn::EdnNode &tx) {
+      schema = txSchema.snapshot();
+      if (tx.type != edn::EdnVector && tx.type != edn::EdnList) {
+        error(0, "", "transaction data must be a vector");
+        return;
+      }
+      size_t form = 0;
+      std::list<edn::EdnNode>::iterator it;
+      for (it = tx.values.begin(); it != tx.values.end(); ++it, ++form) {
+        if (it->type == edn::EdnMap) checkMap(*it, form);
+        else if (it->type == edn::EdnVector || it->type == edn::EdnList) checkList(*it, form);
+        else error(form, "", "expected a map or a list form, got " + text(*it));
+      }
+
+      std::unordered_map<string, size_t>::iterator rit;
+      for (rit = referenced.begin(); rit != referenced.end(); ++rit)
+        if (!asserted.count(rit->first))
+          error(rit->second, ":db/id", "tempid " + rit->first + " is referenced but never asserted");
+    }
+  };
+
+  //nil when the transaction is valid, otherwise {:invalid [[form attribute error] ...]}
+  edn::EdnNode validateTx(string txData) {
+    edn::EdnNode tx;
+    try {
+      tx = edn::read(txData);
+    } catch (const char* e) {
+      return edn::read("{:invalid [[0 nil \"" + escapeString(e) + "\"]]}");
+    }
+
+    TxValidator validator;
+    try {
+      validator.check(tx);
+    } catch (const char* e) {
+      return edn::read("{:invalid [[0 nil \"" + escapeString(e) + "\"]]}");
+    }
+
+    //schema changes reach the server right after this, the next check reloads
+    if (txData.find(":db/ident") != string::npos) txSchema.invalidate();
+    if (!validator.errors.size()) return edn::read("nil");
+
+    std::ostringstream out;
+    out << "{:invalid [";
+    for (unsigned i = 0; i < validator.errors.size(); ++i) {
+      TxError &e = validator.errors[i];
+      out << "[" << e.form << " " << (e.attribute.length() && e.attribute[0] == ':' ? e.attribute : "nil")
+          << " \"" << escapeString(e.message) << "\"]";
+    }
+    out << "]}";
+    return edn::read(out.str());
+  }
+}
@@ -1,17 +1,53 @@
 #include "vendor/edn-cpp/edn.hpp"
 #include "lib/datomicRest.hpp"
+#include "lib/scan.hpp"
+#include "lib/stream.hpp"
+#include "lib/entities.hpp"
+#include "lib/validate.hpp"
+#include "lib/complete.hpp"
+#include "lib/history.hpp"
+#include "lib/jobs.hpp"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string>
 #include <iostream>
 #include <sstream>
+#include <vector>
+#include <signal.h>
 #include <readline/readline.h>
 #include <readline/history.h>
 
 namespace DR = datomicRest;
 
+const char* replCommands[] = {
+  "test", "retract", "clear", "verbose", "validate", "format", "attributes",
+  "storages", "databases", "namespaces", "entity", "query", "transact",
+  "idents", "entities-with", "entities", "fns", "create-fn", "history",
+  "sort", "where", "distinct", "count", "group-by", "path", "jobs", "wait",
+  "kill"
+};
+
+DR::IdentCompleter *completer;
+DR::ResultHistory *history;
+DR::JobTable *jobs;
+std::atomic<bool> interrupted(false);
+std::vector<std::string> completions;
+
+char* completionGenerator(const char* text, int state) {
+  if (!state) completions = completer->complete(text);
+  if (state < int(completions.size())) return strdup(completions[state].c_str());
+  return NULL;
+}
+
+char** completion(const char* text, int start, int end) {
+  rl_attempted_completion_over = 1; //never fall back to filenames
+  return rl_completion_matches(text, completionGenerator);
+}
+
 void printResult(edn::EdnNode &result) {
-  if (DR::format == DR::TBL)
+  if (DR::format == DR::TBL && result.type == edn::EdnVector && !result.values.size())
+    std::cout << "[]" << std::endl;
+  else if (DR::format == DR::TBL)
     if (result.type == edn::EdnMap) {
       try {
         if (DR::atPathExists("[:tx-data]", result)) {
@@ -77,14 +113,206 @@ void printResult(edn::EdnNode &result) {
     std::cout << edn::pprint(result) << std::endl;
 }
 
+//ctrl-c only cancels the request in flight, the session carries on
+void interrupt(int) {
+  interrupted = true;
+}
+
+//moves finished jobs into history, returning the stored result of showId.
+//a later add in the same batch can evict it, so it is looked up by id after
+DR::StoredResult *collectJobs(int showId = 0) {
+  int shownId = 0;
+  std::vector<std::unique_ptr<DR::Job> > done = jobs->collect();
+  for (unsigned i = 0; i < done.size(); ++i) {
+    std::cout << "[" << done[i]->id << "] ";
+    if (done[i]->error.length()) {
+      std::cout << "Error: " << done[i]->error << std::endl;
+      continue;
+    }
+    DR::StoredResult &stored = history->add(done[i]->result, done[i]->header);
+    std::cout << "done $" << stored.id << " " << done[i]->command << std::endl;
+    if (done[i]->id == showId) shownId = stored.id;
+  }
+  if (!shownId) return NULL;
+  try {
+    return &history->get("$" + std::to_string(shownId));
+  } catch (const char* e) {
+    std::cout << "$" << shownId << " was evicted from history" << std::endl;
+    return NULL;
+  }
+}
+
+//announces jobs finishing while the prompt is idle
+int jobEventHook() {
+  if (!jobs->hasFinished()) return 0;
+  std::cout << std::endl;
+  collectJobs();
+  rl_on_new_line();
+  rl_redisplay();
+  return 0;
+}
+
+//commands that only talk to the server, so they can also run as a job
+bool serverCommand(edn::EdnNode node, edn::EdnNode &result) {
+  using std::string;
+
+  if (node.values.front().type == edn::EdnVector) {
+    if (!DR::atPathExists("[0 0]", node.values.front()))
+      result = DR::transact("[" + edn::pprint(node.values.front()) + "]");
+    else
+      result = DR::transact(edn::pprint(node.values.front()));
+    return true;
+  }
+  
+  if (node.values.front().type == edn::EdnList) {
+    result = DR::query("[:find ?value :in $ :where [" + edn::pprint(node.values.front()) + " ?value]]");
+    return true;
+  }
+  
+  if (node.values.front().type == edn::EdnKeyword || node.values.front().type == edn::EdnInt) {
+    result = DR::getEntity(node.values.front().value);
+    if (DR::atPathExists("[:db/fn]", result)) {
+      result = DR::atPath("[:db/fn]", result).values.back();
+    }
+    return true;
+  }
+
+  if (node.values.front().type != edn::EdnSymbol) return false;
+  string command = node.values.front().value; 
+
+  if (command == "retract") { 
+    result = edn::read("{:error \"retract expects an entity id or a vector of ids\"}");
+    if (node.values.size() == 2) { 
+      if (node.values.back().type == edn::EdnInt || node.values.back().type == edn::EdnKeyword) {
+        result = DR::retractEntity(node.values.back().value);
+      }
+      if (node.values.back().type == edn::EdnVector) {
+        result = DR::retractEntities(node.values.back());
+      }
+    }
+    return true;
+  }
+  
+  if (command == "attributes") {
+    if (node.values.size() == 2)
+      result = DR::getAttributes(node.values.back().value);
+    else
+      result = edn::read("{:error \"attributes expects one argument - the namespace\"}");
+    return true;
+  }
+  
+  if (command == "storages") {
+    result = DR::getStorages();
+    return true;
+  }
+    
+  if (command == "databases") {
+    result = DR::getDatabases(DR::alias);
+    return true;
+  }
+    
+  if (command == "namespaces") {
+    result = DR::getNamespaces();
+    return true;
+  }
+
+  if (command == "entity") {
+    result = DR::getEntity(edn::pprint(node.values.back()));
+    return true;
+  }
+    
+  if (command == "query") {
+    result = DR::query(edn::pprint(node.values.back()));
+    return true;
+  }
+  
+  if (command == "transact") {
+    result = DR::transact(edn::pprint(node.values.back()));
+    return true;
+  }
+    
+  if (command == "idents") {
+    if (node.values.size() == 2)
+      result = DR::getIdents(node.values.back().value);
+    else
+      result = edn::read("{:error \"idents expects one argument - the namespace\"}");
+    return true;
+  }
+              
+  if (command == "entities-with") {
+    if (node.values.back().type == edn::EdnKeyword) {
+      result = DR::getEntitiesWith(edn::read("[" + node.values.back().value + "]"));
+    } else if (node.values.back().type == edn::EdnVector) { 
+      result = DR::getEntitiesWith(node.values.back());
+    } else {
+      result = edn::read("{:error \"expects second arg to be a vector of  attributes e.g. [:ns1/attr :ns1/attr2 :ns2/attr3]\"}");
+    }
+    return true;
+  }
+  
+  if (command == "entities") {
+    if (node.values.size() == 2)
+      result = DR::listEntities(node.values.back().value);
+    else
+      result = edn::read("{:error \"entities expects one argument\"}");
+    return true;
+  }
+  
+  if (command == "fns") {
+    result = DR::getFns();
+    return true;
+  }
+  
+  if (command == "create-fn") {
+    node.values.pop_front();
+    
+    //ident 
+    edn::EdnNode ident = node.values.front();
+    node.values.pop_front();
+    
+    //params 
+    edn::EdnNode params = node.values.front();
+    node.values.pop_front();
+    
+    //body 
+    edn::EdnNode code = node.values.front();
+    node.values.pop_front();
+    
+    result = DR::transact(string("[{:db/id #db/id [:db.part/user] ")
+      + string(" :db/ident ") + string(edn::pprint(ident))
+      + string(" :db/fn #db/fn {:lang \"clojure\" ")
+                    + string(" :params ") + string(edn::pprint(params))
+                    + string(" :code ") + string(edn::pprint(code)) + string("}}]"));
+    return true;
+  }
+
+  return false;
+}
+
 int main() {
   using std::string;
 
-  edn::validSymbolChars += "<>'";
+  edn::validSymbolChars += "<>'$";
     
   DR::init();
   
-  rl_bind_key('\t', rl_abort); //disable auto-complete
+  std::vector<string> commandNames(replCommands,
+    replCommands + sizeof(replCommands) / sizeof(replCommands[0]));
+  DR::IdentCompleter identCompleter(commandNames);
+  completer = &identCompleter;
+  identCompleter.start();
+
+  rl_completer_word_break_characters = (char*)" \t\n\"\\'`@$><=;|&{([";
+  rl_attempted_completion_function = completion;
+
+  DR::ResultHistory resultHistory;
+  DR::JobTable jobTable;
+  history = &resultHistory;
+  jobs = &jobTable;
+  rl_event_hook = jobEventHook;
+
+  DR::cancelFlag = &interrupted;
+  signal(SIGINT, interrupt);
   
   char *buf;
   
@@ -99,162 +327,160 @@ int main() {
   while ((buf = readline("\ndtm> ")) != NULL) {
     if (buf[0] == 0) continue;
     DR::queryHeader.values.clear();
+    interrupted = false;
     
     try {
       if (string(buf) != last) add_history(buf);
+      last = string(buf);
+
+      //a trailing & runs the command as a background job
+      string line = buf;
+      bool background = false;
+      rtrim(line);
+      if (line.length() && *line.rbegin() == '&') {
+        background = true;
+        line.erase(line.length() - 1);
+      }
       
-      edn::EdnNode node = edn::read("(" + string(buf) + ")");
+      edn::EdnNode node = edn::read("(" + line + ")");
+      std::vector<edn::EdnNode> argv(node.values.begin(), node.values.end());
+
+      if (background) {
+        DR::Job &job = jobTable.start(trim(line), [node](edn::EdnNode &jobResult) {
+          return serverCommand(node, jobResult);
+        });
+        std::cout << "[" << job.id << "] " << job.command << std::endl;
+        continue;
+      }
+
+      //results land in history as $n; local commands over history set
+      //stored directly and settings toggles are not kept
+      DR::StoredResult *stored = NULL;
+      bool keep = true;
+      bool handled = false;
       
-      if (node.values.front().type == edn::EdnVector) {
-        if (!DR::atPathExists("[0 0]", node.values.front()))
-          result = DR::transact("[" + edn::pprint(node.values.front()) + "]");
-        else
-          result = DR::transact(edn::pprint(node.values.front()));
-      } else if (node.values.front().type == edn::EdnList) {
-        result = DR::query("[:find ?value :in $ :where [" + edn::pprint(node.values.front()) + " ?value]]");
-      } else if (node.values.front().type == edn::EdnKeyword || node.values.front().type == edn::EdnInt) {
-        result = DR::getEntity(node.values.front().value);
-        if (DR::atPathExists("[:db/fn]", result)) {
-          result = DR::atPath("[:db/fn]", result).values.back();
-        }
+      if (DR::ResultHistory::isRef(node.values.front())) {
+        stored = &resultHistory.get(node.values.front().value);
+        handled = true;
       } else if (node.values.front().type == edn::EdnSymbol) {
         command = node.values.front().value; 
+        handled = true;
         
         if (command == "test") { 
           DR::format = DR::TBL;
           DR::queryHeader = edn::read("[?fruit ?vegetable ?animal]");
           result = edn::read("[[apple carrot turtle][banana appletoneske cherrybomb]]");
-        }
-        
-        if (command == "retract") { 
-          if (node.values.size() == 2) { 
-            if (node.values.back().type == edn::EdnInt || node.values.back().type == edn::EdnKeyword) {
-              result = DR::retractEntity(node.values.back().value);
-            }
-            if (node.values.back().type == edn::EdnVector) {
-              result = DR::retractEntities(node.values.back());
-            }
-          }
-        }
-        
-        if (command == "clear") {
+        } else if (command == "clear") {
           //need to make this work for windows differently
           std::cout << "\x1b[2J\x1b[1;1H" << std::flush;
           continue;
-        }
-        
-        if (command == "verbose") {
+        } else if (command == "verbose") {
           if (node.values.size() > 1)
             DR::verbose = (node.values.back().value == "on");
             
           result = edn::read(
             "{:verbose " + string(DR::verbose ? "on" : "off") + "}");
-        }
-        
-        if (command == "validate") {
+          keep = false;
+        } else if (command == "validate") {
           if (node.values.size() > 1)
             DR::validate = (node.values.back().value == "on");
             
           result = edn::read(
             "{:validate " + string(DR::validate ? "on" : "off") + "}");
-        }
-        
-        if (command == "create-enum") {
-          
-        }
-        
-        if (command == "format") {
+          keep = false;
+        } else if (command == "create-enum") {
+          continue;
+        } else if (command == "format") {
           if (node.values.size() > 1)
-            DR::format = DR::getFormatType(node.values.back().value);
-            
-          result = edn::read(
-            "{:format " + DR::getFormatName(DR::format) + "}");
-        }
-        
-        if (command == "attributes")
-          if (node.values.size() == 2)
-            result = DR::getAttributes(node.values.back().value);
-          else
-            result = edn::read("{:error \"attributes expects one argument - the namespace\"}");
-        
-        if (command == "storages") 
-          result = DR::getStorages();
-          
-        if (command == "databases") 
-          result = DR::getDatabases(DR::alias);
-          
-        if (command == "namespaces")
-          result = DR::getNamespaces();
-      
-        if (command == "entity")
-          result = DR::getEntity(edn::pprint(node.values.back()));
-          
-        if (command == "query")
-          result = DR::query(edn::pprint(node.values.back()));
-        
-        if (command == "transact") 
-          result = DR::transact(edn::pprint(node.values.back()));
-          
-        if (command == "idents")
-          if (node.values.size() == 2)
-            result = DR::getIdents(node.values.back().value);
-          else
-            result = edn::read("{:error \"idents expects one argument - the namespace\"}");
-                    
-        if (command == "entities-with") {
-          if (node.values.back().type == edn::EdnKeyword) {
-            result = DR::getEntitiesWith(edn::read("[" + node.values.back().value + "]"));
-          } else if (node.values.back().type == edn::EdnVector) { 
-            result = DR::getEntitiesWith(node.values.back());
+            DR::format = DR::getFormatType(argv[1].value);
+
+          //format X $n re-renders a stored result without refetching it
+          if (argv.size() > 2 && DR::ResultHistory::isRef(argv[2])) {
+            stored = &resultHistory.get(argv[2].value);
           } else {
-            result = edn::read("{:error \"expects second arg to be a vector of  attributes e.g. [:ns1/attr :ns1/attr2 :ns2/attr3]\"}");
+            result = edn::read(
+              "{:format " + DR::getFormatName(DR::format) + "}");
+            keep = false;
           }
+        } else if (command == "history") {
+          result = resultHistory.list();
+          DR::queryHeader = edn::read("[\"ref\" \"rows\" \"columns\" \"bytes\"]");
+          keep = false;
+        } else if (command == "sort") {
+          if (argv.size() < 3 || !DR::ResultHistory::isRef(argv[1]))
+            throw "sort expects $n column [desc]";
+          bool descending = argv.size() > 3 && argv[3].value == "desc";
+          stored = &resultHistory.add(DR::sortResult(resultHistory.get(argv[1].value), argv[2], descending));
+        } else if (command == "where") {
+          if (argv.size() != 5 || !DR::ResultHistory::isRef(argv[1]))
+            throw "where expects $n column op value e.g. where $1 ?age > 30";
+          stored = &resultHistory.add(DR::whereResult(resultHistory.get(argv[1].value), argv[2], argv[3].value, argv[4]));
+        } else if (command == "distinct") {
+          if (argv.size() != 2 || !DR::ResultHistory::isRef(argv[1]))
+            throw "distinct expects $n";
+          stored = &resultHistory.add(DR::distinctResult(resultHistory.get(argv[1].value)));
+        } else if (command == "group-by") {
+          if (argv.size() != 3 || !DR::ResultHistory::isRef(argv[1]))
+            throw "group-by expects $n column";
+          stored = &resultHistory.add(DR::groupByResult(resultHistory.get(argv[1].value), argv[2]));
+        } else if (command == "count") {
+          if (argv.size() != 2 || !DR::ResultHistory::isRef(argv[1]))
+            throw "count expects $n";
+          std::ostringstream count;
+          count << "{:count " << resultHistory.get(argv[1].value).rows << "}";
+          result = edn::read(count.str());
+          keep = false;
+        } else if (command == "path") {
+          if (argv.size() != 3 || !DR::ResultHistory::isRef(argv[1]))
+            throw "path expects $n [path]";
+          result = DR::atPath(edn::pprint(argv[2]), resultHistory.get(argv[1].value).toEdn());
+        } else if (command == "jobs") {
+          result = jobTable.list();
+          DR::queryHeader = edn::read("[\"job\" \"command\" \"status\"]");
+          keep = false;
+        } else if (command == "kill") {
+          if (argv.size() != 2 || argv[1].type != edn::EdnInt)
+            throw "kill expects a job number";
+          if (!jobTable.kill(atoi(argv[1].value.c_str())))
+            throw "no such job";
+          result = edn::read("{:killed " + argv[1].value + "}");
+          keep = false;
+        } else if (command == "wait") {
+          //wait n shows that job's result, plain wait waits for every job
+          int id = argv.size() > 1 ? atoi(argv[1].value.c_str()) : 0;
+          if (id && !jobTable.find(id)) throw "no such job";
+          jobTable.wait(id, interrupted);
+          stored = collectJobs(id);
+          if (!stored) continue;
+        } else {
+          handled = false;
         }
-        
-        if (command == "entities")
-          if (node.values.size() == 2)
-            result = DR::getEntities(node.values.back().value);
-          else
-            result = edn::read("{:error \"entities expects one argument\"}");
-        
-        if (command == "fns") 
-          result = DR::getFns();
-        
-        if (command == "create-fn") {
-          node.values.pop_front();
-          
-          //ident 
-          edn::EdnNode ident = node.values.front();
-          node.values.pop_front();
-          
-          //params 
-          edn::EdnNode params = node.values.front();
-          node.values.pop_front();
-          
-          //body 
-          edn::EdnNode code = node.values.front();
-          node.values.pop_front();
-          
-          result = DR::transact(string("[{:db/id #db/id [:db.part/user] ")
-            + string(" :db/ident ") + string(edn::pprint(ident))
-            + string(" :db/fn #db/fn {:lang \"clojure\" ")
-                          + string(" :params ") + string(edn::pprint(params))
-                          + string(" :code ") + string(edn::pprint(code)) + string("}}]"));
-        }
-        
       }
-      else {
+
+      if (!handled && !serverCommand(node, result))
         result = edn::read("[dtm-repl {:does-not-understand " + edn::pprint(node) + "}]");
+
+      if (stored) {
+        result = stored->toEdn();
+        DR::queryHeader = stored->header;
+      } else if (keep) {
+        stored = &resultHistory.add(result, DR::queryHeader);
       }
+      if (stored) std::cout << "$" << stored->id << std::endl;
+
+      //new idents show up in completion without waiting for the next reload
+      if (line.find(":db/ident") != string::npos || line.find("create-fn") == 0)
+        identCompleter.refresh();
 
       printResult(result); 
     } catch (const char* e) { 
       std::cout << "Error: " << e << std::endl;
     }
-    
-    last = string(buf); 
+
+    collectJobs();
   }
   
   free(buf);
+  identCompleter.stop();
   return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,70 @@
+//keys created in one import batch and referenced from a later one, and the
+//number coercion import relies on. build.sh builds and runs it
+#include "../vendor/edn-cpp/edn.hpp"
+#include "../lib/datomicRest.hpp"
+#include "../lib/scan.hpp"
+#include "../lib/stream.hpp"
+#include "../lib/batch.hpp"
+#include "../lib/validate.hpp"
+#include "../lib/import.hpp"
+
+using std::string;
+using std::vector;
+using std::cout;
+using std::endl;
+
+namespace DR = datomicRest;
+
+int failures = 0;
+
+void check(bool ok, string what) {
+  if (!ok) {
+    cout << "FAIL: " << what << endl;
+    failures++;
+  }
+}
+
+int main() {
+  //#db/id [:db.part/user -1] and -2 as a transactor returns them
+  string body = "{:db-before {:basis-t 1000} :db-after {:basis-t 1001} :tx-data []"
+                " :tempids {-9223350046622220289 17592186045418"
+                " -9223350046622220290 17592186045419}}";
+  std::map<long long, long long> ids = DR::resultTempids(body);
+  check(ids.size() == 2, "both tempids read");
+  check(ids[-1] == 17592186045418LL, "tempid -1 decoded");
+  check(ids[-2] == 17592186045419LL, "tempid -2 decoded");
+
+  DR::ImportKeys keys;
+  vector<string> first;
+  first.push_back("alice");
+  first.push_back("");
+  long long eid = 0;
+  long batch = 0;
+  keys.pending(first, 1);
+  check(keys.find("alice", eid, batch) == DR::ImportKeys::PENDING && batch == 1,
+        "key pending while its batch is in flight");
+
+  //row two of batch one had no key, so -2 belongs to nobody
+  keys.completed(first, 1, ids);
+  check(keys.find("alice", eid, batch) == DR::ImportKeys::RESOLVED && eid == 17592186045418LL,
+        "key from batch one resolves in a later batch");
+  check(keys.find("bob", eid, batch) == DR::ImportKeys::UNKNOWN, "unknown key");
+
+  vector<string> second(1, "carol");
+  std::map<long long, long long> none;
+  keys.pending(second, 2);
+  keys.completed(second, 2, none);
+  check(keys.find("carol", eid, batch) == DR::ImportKeys::FAILED, "key of a failed batch");
+
+  string out;
+  check(DR::coerceValue("1", ":db.type/double", out) && out == "1.0", "integer as double");
+  check(DR::coerceValue("-2.5e3", ":db.type/double", out) && out == "-2.5e3", "exponent");
+  check(DR::coerceValue("1.5M", ":db.type/bigdec", out) && out == "1.5M", "bigdec");
+  const char *bad[] = {"nan", "inf", "-infinity", "0x1p3", "1e999", "1.", ".5", "1e", "1.5M"};
+  for (unsigned i = 0; i < 9; ++i)
+    check(!DR::coerceValue(bad[i], ":db.type/double", out), string("rejects ") + bad[i]);
+  check(!DR::coerceValue("nanM", ":db.type/bigdec", out), "rejects nanM");
+
+  if (!failures) cout << "ok" << endl;
+  return failures ? 1 : 0;
+}